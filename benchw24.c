@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+
+#include "w24proto.h"
+
+// Load generator for serverw24: opens many short sessions (connect, one command, quitc)
+// and reports connections per second plus latency percentiles. With -P it instead measures
+// how many requests one connection sustains, lock-step versus pipelined. With -k it keeps
+// thousands of connections open at once, each sending its next request as soon as the last is answered.
+
+#define MAX_COMMAND_LEN 256
+
+#define DEFAULT_CONCURRENCY 16
+#define DEFAULT_CONNECTIONS 1000
+#define RECV_TIMEOUT_SEC 5
+#define PIPELINE_WINDOW 32
+#define DEFAULT_RUN_SEC 5
+#define CLIENT_LOOP_THREADS 4
+#define MAX_EVENTS 256
+
+struct sockaddr_in serverAddr;
+const char *benchCommand = "dirlist -a";
+int connectionsPerThread;
+
+typedef struct benchThread {
+    pthread_t thread;
+    double *latencies; // Milliseconds from connect() until the first response byte
+    int completed;
+    int failed;
+} benchThread;
+
+double nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int connectToServer(void) {
+    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket == -1) {
+        return -1;
+    }
+
+    struct timeval timeout = { .tv_sec = RECV_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(serverSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
+        close(serverSocket);
+        return -1;
+    }
+    return serverSocket;
+}
+
+//Send a command ("name args") as one binary frame.
+int sendRequest(int serverSocket, const char *command, uint32_t requestId) {
+    char name[MAX_COMMAND_LEN];
+    size_t nameLength = strcspn(command, " ");
+    snprintf(name, sizeof(name), "%.*s", (int)nameLength, command);
+    const char *args = command + nameLength;
+    while (*args == ' ') {
+        args++;
+    }
+
+    int opcode = commandOpcode(name);
+    if (opcode == -1) {
+        return -1;
+    }
+
+    w24Header header = {
+        .magic = W24_MAGIC,
+        .version = W24_VERSION,
+        .opcode = opcode,
+        .requestId = requestId,
+        .flags = 0,
+        .status = STATUS_OK,
+        .payloadLength = strlen(args),
+    };
+    return sendFrame(serverSocket, &header, args);
+}
+
+//Read frames until one ends a response. Returns the id of the request it answered, or 0 on error.
+uint32_t receiveResponseEnd(int serverSocket) {
+    w24Header header;
+    char *payload;
+
+    do {
+        if (recvFrame(serverSocket, &header, &payload) == -1) {
+            return 0;
+        }
+        free(payload);
+    } while (header.flags & FLAG_MORE);
+
+    return header.requestId;
+}
+
+//Run one short session. Returns 0 on success and stores the latency.
+int runSession(double *latency) {
+    double start = nowMs();
+
+    int serverSocket = connectToServer();
+    if (serverSocket == -1) {
+        return -1;
+    }
+
+    if (sendRequest(serverSocket, benchCommand, 1) == -1 || receiveResponseEnd(serverSocket) != 1) {
+        close(serverSocket);
+        return -1;
+    }
+    *latency = nowMs() - start;
+
+    sendRequest(serverSocket, "quitc", 2);
+    close(serverSocket);
+    return 0;
+}
+
+//Issue count requests on one connection with at most window outstanding. Returns requests per second.
+double runPipeline(int count, int window) {
+    int serverSocket = connectToServer();
+    if (serverSocket == -1) {
+        perror("Connection failed");
+        return 0;
+    }
+
+    double start = nowMs();
+    int sent = 0, received = 0;
+    while (received < count) {
+        while (sent < count && sent - received < window) {
+            if (sendRequest(serverSocket, benchCommand, sent + 1) == -1) {
+                perror("Send error");
+                close(serverSocket);
+                return 0;
+            }
+            sent++;
+        }
+        if (receiveResponseEnd(serverSocket) == 0) {
+            perror("Receive error");
+            close(serverSocket);
+            return 0;
+        }
+        received++;
+    }
+    double elapsed = nowMs() - start;
+
+    sendRequest(serverSocket, "quitc", count + 1);
+    close(serverSocket);
+    return count / (elapsed / 1000.0);
+}
+
+void *benchWorker(void *arg) {
+    benchThread *bt = (benchThread *)arg;
+
+    for (int i = 0; i < connectionsPerThread; i++) {
+        double latency;
+        if (runSession(&latency) == 0) {
+            bt->latencies[bt->completed++] = latency;
+        } else {
+            bt->failed++;
+        }
+    }
+
+    return NULL;
+}
+
+//One of the threads driving the -k connections: an epoll loop over its share of them.
+typedef struct clientLoop {
+    pthread_t thread;
+    int *sockets;
+    int count;
+    double runUntil;
+    double *latencies; // Milliseconds from sending a request until its whole response arrived
+    int completed;
+    int capacity;
+    int failed;
+} clientLoop;
+
+void recordLatency(clientLoop *loop, double latency) {
+    if (loop->completed == loop->capacity) {
+        int capacity = loop->capacity ? loop->capacity * 2 : 4096;
+        double *latencies = realloc(loop->latencies, sizeof(double) * capacity);
+        if (!latencies) {
+            return;
+        }
+        loop->latencies = latencies;
+        loop->capacity = capacity;
+    }
+    loop->latencies[loop->completed++] = latency;
+}
+
+void *clientLoopWorker(void *arg) {
+    clientLoop *loop = (clientLoop *)arg;
+    double *sentAt = malloc(sizeof(double) * loop->count);
+    int epollFd = epoll_create1(0);
+    if (!sentAt || epollFd == -1) {
+        perror("Client loop setup failed");
+        loop->failed = loop->count;
+        free(sentAt);
+        return NULL;
+    }
+
+    for (int i = 0; i < loop->count; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        sentAt[i] = nowMs();
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, loop->sockets[i], &ev) == -1 ||
+            sendRequest(loop->sockets[i], benchCommand, 1) == -1) {
+            loop->failed++;
+        }
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (nowMs() < loop->runUntil) {
+        int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, 100);
+        for (int e = 0; e < numEvents; e++) {
+            int i = events[e].data.u32;
+            if (receiveResponseEnd(loop->sockets[i]) == 0) {
+                loop->failed++;
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, loop->sockets[i], NULL);
+                continue;
+            }
+            double now = nowMs();
+            recordLatency(loop, now - sentAt[i]);
+            sentAt[i] = now;
+            if (now < loop->runUntil && sendRequest(loop->sockets[i], benchCommand, 1) == -1) {
+                loop->failed++;
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, loop->sockets[i], NULL);
+            }
+        }
+    }
+
+    close(epollFd);
+    free(sentAt);
+    return NULL;
+}
+
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//-k: open clients connections, then keep every one of them busy for runSec seconds, one request at a time.
+int runClients(int clients, int runSec) {
+    int *sockets = malloc(sizeof(int) * clients);
+    if (!sockets) {
+        return 1;
+    }
+    for (int i = 0; i < clients; i++) {
+        sockets[i] = connectToServer();
+        if (sockets[i] == -1) {
+            fprintf(stderr, "Connection %d failed: %s\n", i + 1, strerror(errno));
+            clients = i;
+            break;
+        }
+    }
+
+    int numLoops = clients < CLIENT_LOOP_THREADS ? clients : CLIENT_LOOP_THREADS;
+    clientLoop loops[CLIENT_LOOP_THREADS];
+    memset(loops, 0, sizeof(loops));
+    double runUntil = nowMs() + runSec * 1000.0;
+    for (int i = 0, first = 0; i < numLoops; i++) {
+        loops[i].count = clients / numLoops + (i < clients % numLoops);
+        loops[i].sockets = sockets + first;
+        loops[i].runUntil = runUntil;
+        first += loops[i].count;
+        pthread_create(&loops[i].thread, NULL, clientLoopWorker, &loops[i]);
+    }
+
+    int completed = 0, failed = 0;
+    for (int i = 0; i < numLoops; i++) {
+        pthread_join(loops[i].thread, NULL);
+        completed += loops[i].completed;
+        failed += loops[i].failed;
+    }
+    double *all = malloc(sizeof(double) * (completed > 0 ? completed : 1));
+    for (int i = 0, at = 0; i < numLoops; i++) {
+        memcpy(all + at, loops[i].latencies, sizeof(double) * loops[i].completed);
+        at += loops[i].completed;
+        free(loops[i].latencies);
+    }
+
+    printf("Command: %s\n", benchCommand);
+    printf("Clients: %d, duration: %d s, completed: %d, failed: %d\n", clients, runSec, completed, failed);
+    printf("Requests/sec: %.1f\n", completed / (double)runSec);
+    if (completed > 0) {
+        qsort(all, completed, sizeof(double), compareDoubles);
+        printf("Latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+               all[completed / 2], all[(int)(completed * 0.90)],
+               all[(int)(completed * 0.99)], all[completed - 1]);
+    }
+
+    for (int i = 0; i < clients; i++) {
+        close(sockets[i]);
+    }
+    free(all);
+    free(sockets);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int concurrency = DEFAULT_CONCURRENCY;
+    int totalConnections = DEFAULT_CONNECTIONS;
+    int pipelineRequests = 0;
+    int keepClients = 0;
+    int runSec = DEFAULT_RUN_SEC;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:m:P:k:t:")) != -1) {
+        switch (opt) {
+            case 'c': concurrency = atoi(optarg); break;
+            case 'n': totalConnections = atoi(optarg); break;
+            case 'm': benchCommand = optarg; break;
+            case 'P': pipelineRequests = atoi(optarg); break;
+            case 'k': keepClients = atoi(optarg); break;
+            case 't': runSec = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s <server_ip> <server_port> [-c concurrency] [-n connections] [-m command] [-P requests] [-k clients [-t seconds]]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 2 || concurrency <= 0 || totalConnections < concurrency || keepClients < 0 || runSec <= 0) {
+        fprintf(stderr, "Usage: %s <server_ip> <server_port> [-c concurrency] [-n connections] [-m command] [-P requests] [-k clients [-t seconds]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &serverAddr.sin_addr) <= 0) {
+        perror("Invalid server IP address");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pipelineRequests > 0) {
+        // Same request stream on one connection, waiting for each answer versus keeping a window in flight
+        double lockStep = runPipeline(pipelineRequests, 1);
+        double pipelined = runPipeline(pipelineRequests, PIPELINE_WINDOW);
+        printf("Command: %s, %d requests on one connection\n", benchCommand, pipelineRequests);
+        printf("Lock-step: %.1f requests/sec\n", lockStep);
+        printf("Pipelined (window %d): %.1f requests/sec\n", PIPELINE_WINDOW, pipelined);
+        return 0;
+    }
+
+    if (keepClients > 0) {
+        return runClients(keepClients, runSec);
+    }
+
+    connectionsPerThread = totalConnections / concurrency;
+    benchThread *threads = calloc(concurrency, sizeof(benchThread));
+
+    double start = nowMs();
+    for (int i = 0; i < concurrency; i++) {
+        threads[i].latencies = malloc(sizeof(double) * connectionsPerThread);
+        pthread_create(&threads[i].thread, NULL, benchWorker, &threads[i]);
+    }
+
+    // Gather latencies from every thread
+    double *all = malloc(sizeof(double) * connectionsPerThread * concurrency);
+    int completed = 0, failed = 0;
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(threads[i].thread, NULL);
+        memcpy(all + completed, threads[i].latencies, sizeof(double) * threads[i].completed);
+        completed += threads[i].completed;
+        failed += threads[i].failed;
+        free(threads[i].latencies);
+    }
+    double elapsed = nowMs() - start;
+
+    printf("Command: %s\n", benchCommand);
+    printf("Concurrency: %d, completed: %d, failed: %d\n", concurrency, completed, failed);
+    printf("Elapsed: %.1f ms, connections/sec: %.1f\n", elapsed, completed / (elapsed / 1000.0));
+
+    if (completed > 0) {
+        qsort(all, completed, sizeof(double), compareDoubles);
+        printf("Latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+               all[completed / 2], all[(int)(completed * 0.90)],
+               all[(int)(completed * 0.99)], all[completed - 1]);
+    }
+
+    free(all);
+    free(threads);
+    return 0;
+}
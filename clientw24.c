@@ -1,33 +1,567 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "w24proto.h"
 
 #define MAX_COMMAND_LEN 256
-#define MAX_RESPONSE_LEN 1024
 
-void sendCommand(int serverSocket, const char *command) {
-    send(serverSocket, command, strlen(command), 0);
+//Requests batch mode keeps outstanding on the connection.
+#define BATCH_WINDOW 32
+
+//Times an interrupted archive download reconnects and resumes before giving up, and the pause between.
+#define RESUME_ATTEMPTS 3
+#define RESUME_DELAY_SEC 1
+
+//Parallel range fetches (-P) at most, and the smallest range worth its own connection.
+#define MAX_PARALLEL_FETCHES 16
+#define MIN_RANGE_LEN (1024 * 1024)
+
+static uint32_t nextRequestId = 1;
+
+static struct sockaddr_in serverAddr;
+
+//Connections a w24get of a whole result is split over (-P).
+static int parallelFetches = 1;
+
+//Codecs to ask for on archive commands that do not name one (-c), best first. The server picks the first one
+//it supports and names the archive it sends after the codec it used.
+static const char *codecPreference = NULL;
+
+//Whether a command's arguments already carry the option.
+int hasOption(const char *args, const char *option) {
+    size_t length = strlen(option);
+    for (const char *p = strstr(args, option); p; p = strstr(p + 1, option)) {
+        if ((p == args || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-void receiveResponse(int serverSocket, char *response) {
-    ssize_t bytesRead = recv(serverSocket, response, MAX_RESPONSE_LEN, 0);
-    if (bytesRead == -1) {
-        perror("Receive error");
+//Send a command as one binary frame: the first word selects the opcode, the rest is the payload.
+//Returns the request id, or 0 if the command is unknown.
+uint32_t sendCommand(int serverSocket, const char *command) {
+    char name[MAX_COMMAND_LEN];
+    size_t nameLength = strcspn(command, " ");
+    if (nameLength >= sizeof(name)) {
+        return 0;
+    }
+    memcpy(name, command, nameLength);
+    name[nameLength] = '\0';
+
+    int opcode = commandOpcode(name);
+    if (opcode == -1) {
+        return 0;
+    }
+
+    const char *args = command + nameLength;
+    while (*args == ' ') {
+        args++;
+    }
+
+    char withCodec[MAX_COMMAND_LEN * 2];
+    int archiveCommand = opcode == OP_W24FZ || opcode == OP_W24FT || opcode == OP_W24FDB || opcode == OP_W24FDA;
+    if (codecPreference && archiveCommand && !hasOption(args, "-c")) {
+        snprintf(withCodec, sizeof(withCodec), "-c %s %s", codecPreference, args);
+        args = withCodec;
+    }
+
+    w24Header header = {
+        .magic = W24_MAGIC,
+        .version = W24_VERSION,
+        .opcode = opcode,
+        .requestId = __atomic_fetch_add(&nextRequestId, 1, __ATOMIC_RELAXED),
+        .flags = 0,
+        .status = STATUS_OK,
+        .payloadLength = strlen(args),
+    };
+    if (sendFrame(serverSocket, &header, args) == -1) {
+        perror("Send error");
         exit(EXIT_FAILURE);
     }
-    response[bytesRead] = '\0'; // Ensure null-terminated string
+    return header.requestId;
+}
+
+//Ask for length bytes (ULLONG_MAX for the rest) of a result from offset. Unlike sendCommand it leaves a
+//failed send to the caller, which can reconnect. Returns -1 if the send failed.
+int sendRangeRequest(int serverSocket, const char *resultId, unsigned long long offset, unsigned long long length) {
+    char args[MAX_COMMAND_LEN];
+    if (length == ULLONG_MAX) {
+        snprintf(args, sizeof(args), "%s %llu", resultId, offset);
+    } else {
+        snprintf(args, sizeof(args), "%s %llu %llu", resultId, offset, length);
+    }
+
+    w24Header header = {
+        .magic = W24_MAGIC,
+        .version = W24_VERSION,
+        .opcode = OP_W24GET,
+        .requestId = __atomic_fetch_add(&nextRequestId, 1, __ATOMIC_RELAXED),
+        .flags = 0,
+        .status = STATUS_OK,
+        .payloadLength = strlen(args),
+    };
+    return sendFrame(serverSocket, &header, args);
+}
+
+//Open a new connection to the server. Returns the socket, or -1.
+int connectServer(void) {
+    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket == -1) {
+        return -1;
+    }
+    if (connect(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
+        close(serverSocket);
+        return -1;
+    }
+    return serverSocket;
+}
+
+//Open ~/w24project/<name> for an incoming archive. In batch mode the name is prefixed with the request id
+//so archives of different requests never overwrite each other. Ranges of a result (w24get) keep the name
+//and the bytes already there, since they are written at their own offset. Returns the fd, or -1.
+int openArchiveFile(const char *name, uint32_t requestId, int ranged, char *path, size_t pathSize) {
+    if (strchr(name, '/') != NULL || name[0] == '\0' || name[0] == '.') {
+        name = "temp.tar.gz";
+    }
+
+    const char *homeDir = getenv("HOME");
+    snprintf(path, pathSize, "%s/w24project", homeDir ? homeDir : ".");
+    mkdir(path, 0755);
+    if (requestId != 0) {
+        snprintf(path, pathSize, "%s/w24project/%u-%s", homeDir ? homeDir : ".", requestId, name);
+    } else {
+        snprintf(path, pathSize, "%s/w24project/%s", homeDir ? homeDir : ".", name);
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | (ranged ? 0 : O_TRUNC), 0644);
+    if (fd == -1) {
+        perror("Failed to create archive file");
+    }
+    return fd;
+}
+
+//Write length bytes at offset. Returns -1 on error.
+int writeAt(int fd, const void *data, size_t length, off_t offset) {
+    const char *ptr = data;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, ptr, length, offset);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        ptr += written;
+        length -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+//Progress of one response. Interactive mode prints text as it arrives; batch mode keeps one per
+//outstanding request and buffers the text until the response is complete.
+typedef struct responseState {
+    uint32_t requestId;
+    char command[MAX_COMMAND_LEN];
+    int batch;
+    char *text;
+    size_t textLen;
+    int archive;
+    char archivePath[MAX_COMMAND_LEN * 2];
+    long long archiveBytes;
+    int archiveStarted;
+    w24ArchiveInfo info;             // As announced by the first reply; a resumed reply continues it
+    unsigned long long archiveOffset; // Where the next archive byte goes in the file
+    int resumed;                      // Reconnected; the next archive frame announces the continuation
+} responseState;
+
+void initResponse(responseState *state) {
+    memset(state, 0, sizeof(*state));
+    state->archive = -1;
+}
+
+//Apply one frame of a response. Returns 1 when it was the last frame.
+int applyFrame(responseState *state, const w24Header *header, const char *payload) {
+    if (header->flags & FLAG_ARCHIVE) {
+        if (state->resumed) {
+            state->resumed = 0; // It starts at archiveOffset, as asked
+        } else if (!state->archiveStarted) {
+            int ranged = header->opcode == OP_W24GET;
+            parseArchiveInfo(payload, header->payloadLength, &state->info);
+            state->archive = openArchiveFile(payload, state->batch && !ranged ? state->requestId : 0, ranged,
+                                             state->archivePath, sizeof(state->archivePath));
+            state->archiveOffset = state->info.offset;
+            state->archiveStarted = 1;
+        } else if (state->archive != -1 && header->payloadLength > 0) {
+            if (writeAt(state->archive, payload, header->payloadLength, state->archiveOffset) == -1) {
+                perror("Failed to write archive file");
+            }
+            state->archiveOffset += header->payloadLength;
+            state->archiveBytes += header->payloadLength;
+        }
+    } else if (state->batch) {
+        char *text = realloc(state->text, state->textLen + header->payloadLength);
+        if (text || header->payloadLength == 0) {
+            state->text = text;
+            memcpy(state->text + state->textLen, payload, header->payloadLength);
+            state->textLen += header->payloadLength;
+        }
+    } else {
+        fwrite(payload, 1, header->payloadLength, stdout);
+    }
+
+    return !(header->flags & FLAG_MORE);
+}
+
+//Print what is left of a finished response and release its resources.
+void finishResponse(responseState *state) {
+    if (state->batch) {
+        printf("[%u] %s\n", state->requestId, state->command);
+        fwrite(state->text, 1, state->textLen, stdout);
+        free(state->text);
+    }
+    if (state->archive != -1) {
+        close(state->archive);
+        printf("Archive saved to %s (%lld bytes", state->archivePath, state->archiveBytes);
+        if (state->info.offset > 0) {
+            printf(" at offset %llu", state->info.offset);
+        }
+        if (state->info.resultId[0] != '\0') {
+            printf(", result id %s", state->info.resultId);
+        }
+        printf(")");
+    }
+    printf("\n");
+    initResponse(state);
+}
+
+//Tell the user how to pick up an archive whose connection dropped.
+void reportInterrupted(const responseState *state) {
+    if (state->archiveStarted && state->info.resultId[0] != '\0') {
+        fprintf(stderr, "Archive %s interrupted; resume with: w24get %s %llu\n", state->archivePath,
+                state->info.resultId, state->archiveOffset);
+    }
+}
+
+//After a dropped connection, reconnect and ask for the rest of the archive being received, from the byte
+//after the last one written (up to the end of the range the command asked for, if it named one).
+//Returns the new socket, or -1 if the archive cannot be resumed.
+int resumeArchive(const responseState *state, const char *command) {
+    if (!state->archiveStarted || state->info.resultId[0] == '\0') {
+        return -1;
+    }
+
+    unsigned long long offset, length, rest = ULLONG_MAX;
+    if (sscanf(command, "w24get %*s %llu %llu", &offset, &length) == 2) {
+        rest = offset + length - state->archiveOffset;
+    }
+
+    for (int attempt = 1; attempt <= RESUME_ATTEMPTS; attempt++) {
+        sleep(RESUME_DELAY_SEC);
+        int serverSocket = connectServer();
+        if (serverSocket == -1) {
+            continue;
+        }
+        if (sendRangeRequest(serverSocket, state->info.resultId, state->archiveOffset, rest) == 0) {
+            fprintf(stderr, "Connection lost, resuming at byte %llu (attempt %d)\n", state->archiveOffset, attempt);
+            return serverSocket;
+        }
+        close(serverSocket);
+    }
+    return -1;
+}
+
+//Read frames until the last one of the response. Text is printed; archives are written to ~/w24project
+//as they arrive, so there is no limit on the size of either. If the connection drops during an archive,
+//the rest is fetched on a new connection (which replaces *serverSocket) and appended.
+void receiveResponse(int *serverSocket, const char *command) {
+    responseState state;
+    initResponse(&state);
+    w24Header header;
+    char *payload;
+    int done;
+    int resumes = 0;
+
+    printf("Server response:\n");
+    do {
+        if (recvFrame(*serverSocket, &header, &payload) == -1) {
+            perror("Receive error");
+            int resumed = resumes++ < RESUME_ATTEMPTS ? resumeArchive(&state, command) : -1;
+            if (resumed == -1) {
+                reportInterrupted(&state);
+                exit(EXIT_FAILURE);
+            }
+            close(*serverSocket);
+            *serverSocket = resumed;
+            state.resumed = 1;
+            done = 0;
+            continue;
+        }
+        done = applyFrame(&state, &header, payload);
+        free(payload);
+    } while (!done);
+
+    finishResponse(&state);
+}
+
+//One connection's share of a parallel w24get: length bytes of the result from offset, written into place.
+typedef struct rangeFetch {
+    const char *resultId;
+    int fd;
+    unsigned long long offset;
+    unsigned long long length;
+    unsigned long long received;
+    int failed;
+    pthread_t thread;
+} rangeFetch;
+
+//Fetch one range on its own connection, reconnecting to continue after the last byte written if it drops.
+void *fetchRange(void *arg) {
+    rangeFetch *fetch = arg;
+
+    for (int attempt = 0; attempt <= RESUME_ATTEMPTS && !fetch->failed && fetch->received < fetch->length;
+         attempt++) {
+        if (attempt > 0) {
+            sleep(RESUME_DELAY_SEC);
+        }
+        int serverSocket = connectServer();
+        if (serverSocket == -1) {
+            continue;
+        }
+        if (sendRangeRequest(serverSocket, fetch->resultId, fetch->offset + fetch->received,
+                             fetch->length - fetch->received) == -1) {
+            close(serverSocket);
+            continue;
+        }
+
+        w24Header header;
+        char *payload;
+        int started = 0, done = 0;
+        while (!done && recvFrame(serverSocket, &header, &payload) == 0) {
+            if (!(header.flags & FLAG_ARCHIVE)) {
+                fprintf(stderr, "Range at %llu: %s\n", fetch->offset, payload);
+                fetch->failed = 1;
+            } else if (!started) {
+                started = 1;
+            } else if (header.payloadLength > 0) {
+                if (writeAt(fetch->fd, payload, header.payloadLength, fetch->offset + fetch->received) == -1) {
+                    fetch->failed = 1;
+                }
+                fetch->received += header.payloadLength;
+            }
+            done = !(header.flags & FLAG_MORE);
+            free(payload);
+        }
+        close(serverSocket);
+    }
+
+    if (fetch->received < fetch->length) {
+        fetch->failed = 1;
+    }
+    return NULL;
+}
+
+//w24get <id> with -P n: learn the archive's size from an empty range, then fetch it as up to n ranges of
+//at least MIN_RANGE_LEN, each on its own connection and written straight into place. Returns -1 if the
+//server does not know the size up front (a compressed result it no longer caches), for the caller to fetch
+//it in one piece instead.
+int fetchParallel(int serverSocket, const char *resultId) {
+    if (sendRangeRequest(serverSocket, resultId, 0, 0) == -1) {
+        perror("Send error");
+        exit(EXIT_FAILURE);
+    }
+
+    // The empty range: just the archive's name and info, or an error
+    w24ArchiveInfo info;
+    char name[MAX_COMMAND_LEN];
+    int isArchive = 0;
+    w24Header header;
+    char *payload;
+    printf("Server response:\n");
+    do {
+        if (recvFrame(serverSocket, &header, &payload) == -1) {
+            perror("Receive error");
+            exit(EXIT_FAILURE);
+        }
+        if ((header.flags & FLAG_ARCHIVE) && !isArchive) {
+            parseArchiveInfo(payload, header.payloadLength, &info);
+            snprintf(name, sizeof(name), "%s", payload);
+            isArchive = 1;
+        } else if (!(header.flags & FLAG_ARCHIVE)) {
+            fwrite(payload, 1, header.payloadLength, stdout);
+        }
+        free(payload);
+    } while (header.flags & FLAG_MORE);
+
+    if (!isArchive) {
+        printf("\n");
+        return 0;
+    }
+    if (info.size < 0) {
+        return -1;
+    }
+
+    char path[MAX_COMMAND_LEN * 2];
+    int fd = openArchiveFile(name, 0, 1, path, sizeof(path));
+    if (fd == -1 || ftruncate(fd, info.size) == -1) {
+        perror("Failed to size archive file");
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    unsigned long long size = info.size;
+    int count = parallelFetches;
+    if (size / count < MIN_RANGE_LEN) {
+        count = size / MIN_RANGE_LEN > 0 ? size / MIN_RANGE_LEN : 1;
+    }
+    unsigned long long rangeLength = (size + count - 1) / count;
+    rangeFetch fetches[MAX_PARALLEL_FETCHES];
+    for (int i = 0; i < count; i++) {
+        fetches[i] = (rangeFetch){ resultId, fd, i * rangeLength, 0, 0, 0, 0 };
+        fetches[i].length = size - fetches[i].offset < rangeLength ? size - fetches[i].offset : rangeLength;
+        if (pthread_create(&fetches[i].thread, NULL, fetchRange, &fetches[i]) != 0) {
+            fetchRange(&fetches[i]); // No thread: fetch it here instead
+            fetches[i].thread = 0;
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (fetches[i].thread) {
+            pthread_join(fetches[i].thread, NULL);
+        }
+        if (fetches[i].failed) {
+            fprintf(stderr, "Range %llu-%llu incomplete; fetch it with: w24get %s %llu %llu\n",
+                    fetches[i].offset, fetches[i].offset + fetches[i].length, resultId,
+                    fetches[i].offset + fetches[i].received, fetches[i].length - fetches[i].received);
+            failed = 1;
+        }
+    }
+    close(fd);
+    printf("Archive %s %s (%llu bytes in %d ranges, result id %s)\n", failed ? "partly saved to" : "saved to", path,
+           size, count, resultId);
+    return 0;
+}
+
+//Batch mode: send every command read from stdin over the one connection with up to BATCH_WINDOW
+//requests outstanding, and print each response as soon as it completes (not necessarily in order).
+void runBatch(int serverSocket) {
+    responseState *pending = calloc(BATCH_WINDOW, sizeof(responseState));
+    if (!pending) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < BATCH_WINDOW; i++) {
+        initResponse(&pending[i]);
+    }
+
+    char command[MAX_COMMAND_LEN];
+    int outstanding = 0;
+    int endOfInput = 0;
+
+    while (!endOfInput || outstanding > 0) {
+        // Fill the window
+        while (!endOfInput && outstanding < BATCH_WINDOW) {
+            if (fgets(command, MAX_COMMAND_LEN, stdin) == NULL) {
+                endOfInput = 1;
+                break;
+            }
+            command[strcspn(command, "\n")] = '\0';
+            if (command[0] == '\0') {
+                continue;
+            }
+            if (strcmp(command, "quitc") == 0) {
+                endOfInput = 1;
+                break;
+            }
+
+            uint32_t requestId = sendCommand(serverSocket, command);
+            if (requestId == 0) {
+                printf("Invalid command: %s\n\n", command);
+                continue;
+            }
+
+            responseState *state = pending;
+            while (state->requestId != 0) {
+                state++;
+            }
+            state->requestId = requestId;
+            state->batch = 1;
+            snprintf(state->command, sizeof(state->command), "%s", command);
+            outstanding++;
+        }
+        if (outstanding == 0) {
+            break;
+        }
+
+        // Route the next frame to the request it answers
+        w24Header header;
+        char *payload;
+        if (recvFrame(serverSocket, &header, &payload) == -1) {
+            perror("Receive error");
+            for (int i = 0; i < BATCH_WINDOW; i++) {
+                reportInterrupted(&pending[i]);
+            }
+            exit(EXIT_FAILURE);
+        }
+
+        responseState *state = NULL;
+        for (int i = 0; i < BATCH_WINDOW; i++) {
+            if (pending[i].requestId == header.requestId) {
+                state = &pending[i];
+                break;
+            }
+        }
+        if (!state) {
+            fprintf(stderr, "Response for unknown request %u\n", header.requestId);
+        } else if (applyFrame(state, &header, payload)) {
+            finishResponse(state);
+            outstanding--;
+        }
+        free(payload);
+    }
+
+    sendCommand(serverSocket, "quitc");
+    free(pending);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <server_ip> <server_port>\n", argv[0]);
+    int batch = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bc:P:")) != -1) {
+        if (opt == 'b') {
+            batch = 1;
+        } else if (opt == 'c') {
+            codecPreference = optarg;
+        } else if (opt == 'P' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_PARALLEL_FETCHES) {
+            parallelFetches = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-b] [-c codec[:level][,...]] [-P connections] <server_ip> <server_port>\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 2) {
+        fprintf(stderr, "Usage: %s [-b] [-c codec[:level][,...]] [-P connections] <server_ip> <server_port>\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    const char *serverIp = argv[1];
-    int serverPort = atoi(argv[2]);
+    const char *serverIp = argv[optind];
+    int serverPort = atoi(argv[optind + 1]);
 
     // Create socket
     int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
@@ -37,7 +571,6 @@ int main(int argc, char *argv[]) {
     }
 
     // Configure server address
-    struct sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(serverPort);
     if (inet_pton(AF_INET, serverIp, &serverAddr.sin_addr) <= 0) {
@@ -53,12 +586,19 @@ int main(int argc, char *argv[]) {
 
     printf("Connected to server %s:%d\n", serverIp, serverPort);
 
+    if (batch) {
+        runBatch(serverSocket);
+        close(serverSocket);
+        return 0;
+    }
+
     char command[MAX_COMMAND_LEN];
-    char response[MAX_RESPONSE_LEN];
 
     while (1) {
         printf("Enter command : ");
-        fgets(command, MAX_COMMAND_LEN, stdin);
+        if (fgets(command, MAX_COMMAND_LEN, stdin) == NULL) {
+            strcpy(command, "quitc"); // End of input
+        }
         command[strcspn(command, "\n")] = '\0'; // Remove newline character
 
         if (strcmp(command, "quitc") == 0) {
@@ -66,9 +606,18 @@ int main(int argc, char *argv[]) {
             break; // Exit loop if quit command is sent
         }
 
-        sendCommand(serverSocket, command);
-        receiveResponse(serverSocket, response);
-        printf("Server response:\n%s\n", response);
+        // w24get <id> alone, with -P: the whole result in parallel ranges
+        char resultId[W24_RESULT_ID_LEN + 1], extra;
+        if (parallelFetches > 1 && sscanf(command, "w24get %32s %c", resultId, &extra) == 1 &&
+            fetchParallel(serverSocket, resultId) == 0) {
+            continue;
+        }
+
+        if (sendCommand(serverSocket, command) == 0) {
+            printf("Invalid command\n");
+            continue;
+        }
+        receiveResponse(&serverSocket, command);
     }
 
     // Close socket
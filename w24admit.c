@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "w24admit.h"
+
+int admissionInit(w24Admission *admission, int maxActive, int maxQueued, int timeoutMs) {
+    memset(admission, 0, sizeof(*admission));
+    admission->maxActive = maxActive;
+    admission->maxQueued = maxQueued;
+    admission->timeoutMs = timeoutMs;
+    pthread_mutex_init(&admission->lock, NULL);
+    admission->queue = malloc(sizeof(admissionWaiter) * (maxQueued > 0 ? maxQueued : 1));
+    return admission->queue ? 0 : -1;
+}
+
+void admissionFree(w24Admission *admission) {
+    free(admission->queue);
+    pthread_mutex_destroy(&admission->lock);
+}
+
+int admissionEnter(w24Admission *admission, int fd, int id, void *context, double nowMs) {
+    int decision;
+    pthread_mutex_lock(&admission->lock);
+    if (admission->active < admission->maxActive && admission->queued == 0) {
+        // Nobody is ahead of it
+        admission->active++;
+        admission->admitted++;
+        decision = ADMIT_NOW;
+    } else if (admission->queued < admission->maxQueued) {
+        admissionWaiter *waiter = &admission->queue[(admission->head + admission->queued) % admission->maxQueued];
+        waiter->fd = fd;
+        waiter->id = id;
+        waiter->context = context;
+        waiter->queuedMs = nowMs;
+        admission->queued++;
+        if (admission->queued > admission->peakQueued) {
+            admission->peakQueued = admission->queued;
+        }
+        decision = ADMIT_QUEUED;
+    } else {
+        admission->rejected++;
+        decision = ADMIT_REJECTED;
+    }
+    pthread_mutex_unlock(&admission->lock);
+    return decision;
+}
+
+int admissionLeave(w24Admission *admission) {
+    pthread_mutex_lock(&admission->lock);
+    admission->active--;
+    int waiting = admission->queued > 0;
+    pthread_mutex_unlock(&admission->lock);
+    return waiting;
+}
+
+int admissionNext(w24Admission *admission, double nowMs, admissionWaiter *waiter) {
+    int action = 0;
+    pthread_mutex_lock(&admission->lock);
+    if (admission->queued > 0) {
+        admissionWaiter *oldest = &admission->queue[admission->head];
+        double waitMs = nowMs - oldest->queuedMs;
+        if (admission->active < admission->maxActive) {
+            admission->active++;
+            admission->waited++;
+            admission->totalWaitMs += waitMs;
+            if (waitMs > admission->maxWaitMs) {
+                admission->maxWaitMs = waitMs;
+            }
+            action = 1;
+        } else if (waitMs >= admission->timeoutMs) {
+            admission->timedOut++;
+            action = -1;
+        }
+        if (action != 0) {
+            *waiter = *oldest;
+            admission->head = (admission->head + 1) % admission->maxQueued;
+            admission->queued--;
+        }
+    }
+    pthread_mutex_unlock(&admission->lock);
+    return action;
+}
+
+int admissionTimeout(w24Admission *admission, double nowMs) {
+    int timeoutMs = -1;
+    pthread_mutex_lock(&admission->lock);
+    if (admission->queued > 0) {
+        // Arrival order is deadline order, so the oldest connection is the next to time out
+        double remaining = admission->queue[admission->head].queuedMs + admission->timeoutMs - nowMs;
+        timeoutMs = remaining > 0 ? (int)remaining + 1 : 0;
+    }
+    pthread_mutex_unlock(&admission->lock);
+    return timeoutMs;
+}
+
+int admissionStats(w24Admission *admission, char *out, size_t size) {
+    pthread_mutex_lock(&admission->lock);
+    int length = snprintf(out, size,
+                          "admission: %d of %d active, %d of %d queued (peak %d), %lu admitted, %lu after waiting "
+                          "(avg %.1f ms, max %.1f ms), %lu rejected, %lu timed out\n",
+                          admission->active, admission->maxActive, admission->queued, admission->maxQueued,
+                          admission->peakQueued, admission->admitted, admission->waited,
+                          admission->waited ? admission->totalWaitMs / admission->waited : 0, admission->maxWaitMs,
+                          admission->rejected, admission->timedOut);
+    pthread_mutex_unlock(&admission->lock);
+    return length;
+}
@@ -0,0 +1,66 @@
+//Admission control for client connections: at most maxActive are served at once, up to maxQueued more wait
+//for a slot in arrival order, and a connection is turned away only when the queue is full or it waited longer
+//than the timeout. Slots are given back the moment a connection ends, on whichever thread ends it.
+#ifndef W24ADMIT_H
+#define W24ADMIT_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define DEFAULT_ADMISSION_QUEUE 128
+#define DEFAULT_ADMISSION_TIMEOUT_MS 5000
+
+//What admissionEnter decided.
+#define ADMIT_NOW 0
+#define ADMIT_QUEUED 1
+#define ADMIT_REJECTED 2
+
+//A connection waiting for a slot. context is the caller's, handed back when it is admitted or times out.
+typedef struct admissionWaiter {
+    int fd;
+    int id;
+    void *context;
+    double queuedMs;
+} admissionWaiter;
+
+typedef struct w24Admission {
+    int maxActive;
+    int maxQueued;
+    int timeoutMs;
+    int active;
+    admissionWaiter *queue; // Ring of maxQueued entries, oldest at head
+    int head;
+    int queued;
+
+    unsigned long admitted;  // Served without waiting
+    unsigned long waited;    // Served after waiting for a slot
+    unsigned long rejected;  // Turned away because the queue was full
+    unsigned long timedOut;  // Turned away after waiting timeoutMs
+    int peakQueued;
+    double totalWaitMs;      // Over the waited connections
+    double maxWaitMs;
+    pthread_mutex_t lock;
+} w24Admission;
+
+//Returns -1 if the queue cannot be allocated.
+int admissionInit(w24Admission *admission, int maxActive, int maxQueued, int timeoutMs);
+void admissionFree(w24Admission *admission);
+
+//A new connection arrived at nowMs (a monotonic clock in ms). ADMIT_NOW: it holds a slot and is served.
+//ADMIT_QUEUED: it waits; admissionNext hands it back. ADMIT_REJECTED: the queue is full.
+int admissionEnter(w24Admission *admission, int fd, int id, void *context, double nowMs);
+
+//A connection holding a slot ended. Returns 1 if connections are waiting for the slot.
+int admissionLeave(w24Admission *admission);
+
+//Take the oldest waiting connection if something is due for it at nowMs: 1 if it got a slot, -1 if its wait
+//timed out, 0 (nothing taken) if it must keep waiting or none waits.
+int admissionNext(w24Admission *admission, double nowMs, admissionWaiter *waiter);
+
+//ms from nowMs until the oldest waiting connection times out (0 if it already has), or -1 if none waits.
+int admissionTimeout(w24Admission *admission, double nowMs);
+
+//One line of slot, queue and wait time counters for w24stats. Returns its length.
+int admissionStats(w24Admission *admission, char *out, size_t size);
+
+#endif
@@ -0,0 +1,1024 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "w24archive.h"
+#include "w24proto.h"
+#include "w24gzip.h"
+
+//Where libarchive's output goes: straight to the client socket, through the parallel compressor if there is one.
+//Only the bytes in [rangeStart, rangeEnd) of the archive are sent; the tee gets all of them.
+typedef struct archiveStream {
+    const w24Reply *reply;
+    gzipStream *gzip;
+    archiveTee *tee;
+    unsigned long long position; // Archive bytes produced so far
+    unsigned long long rangeStart;
+    unsigned long long rangeEnd;
+    int clientGone; // A send failed
+    int failed;     // Production stopped: the client went away or has its range, and nothing else wants the rest
+} archiveStream;
+
+//tar headers and bodies come in blocks of this size.
+#define TAR_BLOCK_LEN 512
+
+//Names clients use, archive file suffixes, the levels libarchive accepts and the magic numbers the
+//compressed streams start with, by ARCHIVE_CODEC_*.
+typedef struct archiveCodec {
+    const char *name;
+    const char *suffix;
+    int minLevel;
+    int maxLevel;
+    const char *magic;
+} archiveCodec;
+
+static const archiveCodec codecs[ARCHIVE_NUM_CODECS] = {
+    { "none", ".tar", 0, 0, "" },
+    { "gzip", ".tar.gz", 0, 9, "\x1f\x8b" },
+    { "zstd", ".tar.zst", 1, 22, "\x28\xb5\x2f\xfd" },
+    { "lz4", ".tar.lz4", 1, 9, "\x04\x22\x4d\x18" },
+};
+
+void archiveListInit(archiveList *list) {
+    list->members = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+int archiveListAdd(archiveList *list, const char *name) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        archiveMember *members = realloc(list->members, sizeof(archiveMember) * capacity);
+        if (!members) {
+            return -1;
+        }
+        list->members = members;
+        list->capacity = capacity;
+    }
+
+    char *copy = strdup(name);
+    if (!copy) {
+        return -1;
+    }
+    list->members[list->count].name = copy;
+    list->count++;
+    return 0;
+}
+
+void archiveListFree(archiveList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->members[i].name);
+    }
+    free(list->members);
+    archiveListInit(list);
+}
+
+static int compareMembers(const void *a, const void *b) {
+    return strcmp(((const archiveMember *)a)->name, ((const archiveMember *)b)->name);
+}
+
+void archiveListSort(archiveList *list) {
+    if (list->count > 1) {
+        qsort(list->members, list->count, sizeof(archiveMember), compareMembers);
+    }
+}
+
+int archiveListCopy(archiveList *copy, const archiveList *list) {
+    archiveListInit(copy);
+    for (int i = 0; i < list->count; i++) {
+        if (archiveListAdd(copy, list->members[i].name) == -1) {
+            archiveListFree(copy);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void streamInit(archiveStream *stream, const w24Reply *reply, const archiveOptions *options) {
+    memset(stream, 0, sizeof(*stream));
+    stream->reply = reply;
+    stream->tee = options->tee;
+    stream->rangeStart = options->rangeOffset;
+    stream->rangeEnd = options->rangeLength > ULLONG_MAX - options->rangeOffset
+                           ? ULLONG_MAX : options->rangeOffset + options->rangeLength;
+}
+
+//Whether anyone wants the bytes still to come: the client until its range is out, the tee until the end.
+static int streamWanted(const archiveStream *stream) {
+    return (!stream->clientGone && stream->position < stream->rangeEnd) || (stream->tee && !stream->tee->failed);
+}
+
+//The part of the next length archive bytes that falls in the client's range, as an offset into them and a
+//length. Returns 0 if none does.
+static int rangePart(const archiveStream *stream, unsigned long long length, unsigned long long *skip,
+                     unsigned long long *count) {
+    if (stream->clientGone || stream->position >= stream->rangeEnd) {
+        return 0;
+    }
+    unsigned long long start = stream->position > stream->rangeStart ? stream->position : stream->rangeStart;
+    unsigned long long end = stream->rangeEnd - stream->position > length ? stream->position + length
+                                                                           : stream->rangeEnd;
+    if (start >= end) {
+        return 0;
+    }
+    *skip = start - stream->position;
+    *count = end - start;
+    return 1;
+}
+
+//Send archive bytes to the client, as far as they fall in its range, copying them all to the tee if there
+//is one. A failed copy only spoils the copy. Returns -1 once nobody wants more.
+static int streamBytes(archiveStream *stream, const void *data, size_t length) {
+    archiveTee *tee = stream->tee;
+    if (tee && !tee->failed) {
+        const char *ptr = data;
+        size_t left = length;
+        while (left > 0) {
+            ssize_t written = write(tee->fd, ptr, left);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written == -1) {
+                tee->failed = 1;
+                break;
+            }
+            ptr += written;
+            left -= written;
+        }
+        tee->bytes += length - left;
+    }
+
+    unsigned long long skip, count;
+    if (rangePart(stream, length, &skip, &count) &&
+        sendArchiveData(stream->reply, (const char *)data + skip, count) == -1) {
+        stream->clientGone = 1;
+    }
+    stream->position += length;
+    return streamWanted(stream) ? 0 : -1;
+}
+
+//Same for length bytes of a file, which go out with sendfile.
+static int streamFileBytes(archiveStream *stream, int fd, off_t length) {
+    unsigned long long skip, count;
+    if (rangePart(stream, length, &skip, &count) && sendArchiveFile(stream->reply, fd, skip, count) == -1) {
+        stream->clientGone = 1;
+    }
+    stream->position += length;
+    return streamWanted(stream) ? 0 : -1;
+}
+
+//End the reply unless the client went away. Returns -1 if it did.
+static int endStream(archiveStream *stream) {
+    if (!stream->clientGone && sendArchiveEnd(stream->reply) == -1) {
+        stream->clientGone = 1;
+    }
+    return stream->clientGone ? -1 : 0;
+}
+
+//The info announcing an archive of size bytes (-1 if not known yet).
+static void describeArchive(w24ArchiveInfo *info, const archiveOptions *options, long long size) {
+    memset(info, 0, sizeof(*info));
+    if (options->resultId) {
+        snprintf(info->resultId, sizeof(info->resultId), "%s", options->resultId);
+    }
+    info->offset = options->rangeOffset;
+    info->size = size;
+}
+
+//gzipStream output: compressed blocks go out in stream order as soon as they are ready.
+static int gzipToClient(void *context, const void *data, size_t length) {
+    return streamBytes(context, data, length);
+}
+
+//libarchive write callback: every compressed block goes out as soon as it is produced. With a parallel
+//compressor, libarchive writes plain tar and the blocks are compressed here.
+static ssize_t archiveStreamWrite(struct archive *a, void *clientData, const void *buffer, size_t length) {
+    archiveStream *stream = clientData;
+    (void)a;
+
+    int result = stream->gzip ? gzipStreamWrite(stream->gzip, buffer, length)
+                              : streamBytes(stream, buffer, length);
+    if (result == -1) {
+        stream->failed = 1;
+        return -1;
+    }
+    return length;
+}
+
+//libarchive close callback: flush the parallel compressor; the tee now holds the whole archive.
+static int archiveStreamClose(struct archive *a, void *clientData) {
+    archiveStream *stream = clientData;
+    (void)a;
+
+    if (!stream->failed && stream->gzip && gzipStreamFinish(stream->gzip) == -1) {
+        stream->failed = 1;
+    }
+    if (!stream->failed && stream->tee) {
+        stream->tee->complete = 1;
+    }
+    return stream->failed ? ARCHIVE_FATAL : ARCHIVE_OK;
+}
+
+void archiveOptionsInit(archiveOptions *options) {
+    options->threads = 1;
+    options->codec = ARCHIVE_CODEC_GZIP;
+    options->level = ARCHIVE_LEVEL_DEFAULT;
+    options->tee = NULL;
+    options->blocks = NULL;
+    options->prefetch = 1;
+    options->resultId = NULL;
+    options->rangeOffset = 0;
+    options->rangeLength = ARCHIVE_TO_END;
+    options->inputBytes = NULL;
+}
+
+const char *archiveCodecName(int codec) {
+    return codecs[codec].name;
+}
+
+const char *archiveCodecSuffix(int codec) {
+    return codecs[codec].suffix;
+}
+
+static int addCodecFilter(struct archive *a, int codec) {
+    switch (codec) {
+    case ARCHIVE_CODEC_GZIP:
+        // No timestamp in the gzip header, so the same input always compresses to the same bytes
+        if (archive_write_add_filter_gzip(a) != ARCHIVE_OK) {
+            return ARCHIVE_FATAL;
+        }
+        return archive_write_set_filter_option(a, "gzip", "timestamp", NULL);
+    case ARCHIVE_CODEC_ZSTD:
+        return archive_write_add_filter_zstd(a);
+    case ARCHIVE_CODEC_LZ4:
+        return archive_write_add_filter_lz4(a);
+    default:
+        return archive_write_add_filter_none(a);
+    }
+}
+
+int archiveCodecSupported(int codec) {
+    struct archive *a = archive_write_new();
+    int supported = addCodecFilter(a, codec) == ARCHIVE_OK;
+    archive_write_free(a);
+    return supported;
+}
+
+int archiveCodecDetect(const void *head, size_t length) {
+    for (int codec = 0; codec < ARCHIVE_NUM_CODECS; codec++) {
+        size_t magicLength = strlen(codecs[codec].magic);
+        if (magicLength > 0 && length >= magicLength && memcmp(head, codecs[codec].magic, magicLength) == 0) {
+            return codec;
+        }
+    }
+    return ARCHIVE_CODEC_NONE;
+}
+
+int archiveSelectCodec(const char *preferences, archiveOptions *options) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", preferences);
+
+    char *savePtr;
+    for (char *token = strtok_r(copy, ",", &savePtr); token; token = strtok_r(NULL, ",", &savePtr)) {
+        char *levelText = strchr(token, ':');
+        if (levelText) {
+            *levelText++ = '\0';
+        }
+
+        int codec = 0;
+        while (codec < ARCHIVE_NUM_CODECS && strcasecmp(token, codecs[codec].name) != 0) {
+            codec++;
+        }
+        if (codec == ARCHIVE_NUM_CODECS) {
+            continue; // Unknown here; maybe a codec of a newer server
+        }
+
+        int level = ARCHIVE_LEVEL_DEFAULT;
+        if (levelText) {
+            char *end;
+            long value = strtol(levelText, &end, 10);
+            if (end == levelText || *end != '\0' || value < codecs[codec].minLevel || value > codecs[codec].maxLevel) {
+                return -1;
+            }
+            level = value;
+        }
+
+        if (archiveCodecSupported(codec)) {
+            options->codec = codec;
+            options->level = level;
+            return 0;
+        }
+    }
+
+    options->codec = ARCHIVE_CODEC_GZIP;
+    options->level = ARCHIVE_LEVEL_DEFAULT;
+    return 0;
+}
+
+//Set up the compression filter for the requested codec, falling back to gzip if libarchive refuses it.
+//Returns the codec in use.
+static int setupCodec(struct archive *a, archiveStream *stream, const archiveOptions *options) {
+    int codec = options->codec;
+    if (codec == ARCHIVE_CODEC_GZIP && options->threads > 1 &&
+        (stream->gzip = gzipStreamNew(options->threads, options->level, gzipToClient, stream)) != NULL) {
+        archive_write_add_filter_none(a);
+        return codec;
+    }
+
+    if (!archiveCodecSupported(codec)) {
+        fprintf(stderr, "Codec %s unavailable, using gzip\n", codecs[codec].name);
+        codec = ARCHIVE_CODEC_GZIP;
+    }
+    addCodecFilter(a, codec);
+    if (codec == options->codec && options->level != ARCHIVE_LEVEL_DEFAULT && codec != ARCHIVE_CODEC_NONE) {
+        char level[16];
+        snprintf(level, sizeof(level), "%d", options->level);
+        archive_write_set_filter_option(a, NULL, "compression-level", level);
+    }
+    if (codec == ARCHIVE_CODEC_ZSTD && options->threads > 1) {
+        char threads[16];
+        snprintf(threads, sizeof(threads), "%d", options->threads);
+        archive_write_set_filter_option(a, "zstd", "threads", threads);
+    }
+    return codec;
+}
+
+//Open a member and stat the opened file. Opening before any header is written means an unreadable file
+//is skipped instead of leaving a hole. Returns the fd, or -1.
+static int openMember(const char *baseDir, const archiveMember *member, struct stat *st) {
+    char filePath[PATH_MAX * 2];
+    snprintf(filePath, sizeof(filePath), "%s/%s", baseDir, member->name);
+
+    int fd = open(filePath, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open file for archiving: %s\n", strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, st) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//A member made it into the archive: add its size to the caller's input total, if it keeps one.
+static void countInput(const archiveOptions *options, const struct stat *st) {
+    if (options->inputBytes) {
+        *options->inputBytes += st->st_size;
+    }
+}
+
+//Write value as a NUL-terminated octal tar field. Returns -1 if it does not fit.
+static int tarOctal(char *field, size_t width, unsigned long long value) {
+    if (value >> (3 * (width - 1)) != 0) {
+        return -1;
+    }
+    snprintf(field, width, "%0*llo", (int)width - 1, value);
+    return 0;
+}
+
+//Append one pax record, "<length> key=value\n", where length counts the whole record including itself.
+static int appendPaxRecord(w24Buffer *out, const char *key, const char *value) {
+    size_t body = strlen(key) + strlen(value) + 3; // Space, '=' and newline
+    size_t length = body + 1;
+    while (length != body + (size_t)snprintf(NULL, 0, "%zu", length)) {
+        length = body + snprintf(NULL, 0, "%zu", length);
+    }
+    char record[PATH_MAX * 2 + 64];
+    int written = snprintf(record, sizeof(record), "%zu %s=%s\n", length, key, value);
+    return written < 0 || (size_t)written >= sizeof(record) ? -1 : bufferAppend(out, record, written);
+}
+
+//Append a 512-byte ustar header block; the checksum is computed over the block with its own field as spaces.
+static int appendUstarBlock(w24Buffer *out, const char *name, const struct stat *st, char type, size_t size,
+                            long long mtime) {
+    char block[TAR_BLOCK_LEN];
+    memset(block, 0, sizeof(block));
+    strncpy(block, name, 100);
+    tarOctal(block + 100, 8, st->st_mode & 07777);
+    if (tarOctal(block + 108, 8, st->st_uid) == -1) {
+        tarOctal(block + 108, 8, 0);
+    }
+    if (tarOctal(block + 116, 8, st->st_gid) == -1) {
+        tarOctal(block + 116, 8, 0);
+    }
+    tarOctal(block + 124, 12, size);
+    tarOctal(block + 136, 12, mtime);
+    block[156] = type;
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+
+    memset(block + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < TAR_BLOCK_LEN; i++) {
+        checksum += (unsigned char)block[i];
+    }
+    snprintf(block + 148, 8, "%06o", checksum);
+    return bufferAppend(out, block, sizeof(block));
+}
+
+//Append the header of a regular file. Names, sizes and times that ustar cannot hold go in a pax extended
+//header first, as libarchive's pax_restricted format does.
+static int appendTarHeader(w24Buffer *out, const char *name, const struct stat *st) {
+    char field[12];
+    int longName = strlen(name) > 100;
+    int bigSize = tarOctal(field, 12, st->st_size) == -1;
+    int oddTime = st->st_mtime < 0 || tarOctal(field, 12, st->st_mtime) == -1;
+
+    if (longName || bigSize || oddTime) {
+        w24Buffer records;
+        bufferInit(&records);
+        char number[32];
+        int failed = 0;
+        if (longName) {
+            failed |= appendPaxRecord(&records, "path", name);
+        }
+        if (bigSize) {
+            snprintf(number, sizeof(number), "%lld", (long long)st->st_size);
+            failed |= appendPaxRecord(&records, "size", number);
+        }
+        if (oddTime) {
+            snprintf(number, sizeof(number), "%lld", (long long)st->st_mtime);
+            failed |= appendPaxRecord(&records, "mtime", number);
+        }
+
+        const char *slash = strrchr(name, '/');
+        char paxName[TAR_BLOCK_LEN];
+        snprintf(paxName, sizeof(paxName), "PaxHeader/%.80s", slash ? slash + 1 : name);
+        static const char zeros[TAR_BLOCK_LEN];
+        failed |= appendUstarBlock(out, paxName, st, 'x', records.length, 0);
+        failed |= bufferAppend(out, records.data, records.length);
+        failed |= bufferAppend(out, zeros, (TAR_BLOCK_LEN - records.length % TAR_BLOCK_LEN) % TAR_BLOCK_LEN);
+        bufferFree(&records);
+        if (failed) {
+            return -1;
+        }
+    }
+
+    return appendUstarBlock(out, name, st, '0', bigSize ? 0 : st->st_size, oddTime ? 0 : st->st_mtime);
+}
+
+//Size of the uncompressed archive of the list, from the headers streamPlainTar would send. Returns -1 on
+//allocation failure.
+static long long plainTarSize(const char *baseDir, const archiveList *list) {
+    w24Buffer header;
+    bufferInit(&header);
+    long long size = TAR_BLOCK_LEN * 2;
+    for (int i = 0; i < list->count && size != -1; i++) {
+        struct stat st;
+        int fd = openMember(baseDir, &list->members[i], &st);
+        if (fd == -1) {
+            continue;
+        }
+        close(fd);
+        header.length = 0;
+        if (!S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (appendTarHeader(&header, list->members[i].name, &st) == -1) {
+            size = -1;
+            break;
+        }
+        size += header.length + (st.st_size + TAR_BLOCK_LEN - 1) / TAR_BLOCK_LEN * TAR_BLOCK_LEN;
+    }
+    bufferFree(&header);
+    return size;
+}
+
+//Uncompressed archives skip libarchive: headers are built here and every file body goes from the page cache
+//to the socket with sendfile. Headers, padding and the end-of-archive blocks are gathered in one buffer
+//and sent just before the next body, so each file costs two frames. A range skips whole files for free:
+//only their headers are built.
+static int streamPlainTar(archiveStream *stream, const char *baseDir, const archiveList *list, const char *baseName,
+                          const archiveOptions *options) {
+    // A range request needs the size up front to plan its next ranges; whole archives do without
+    int ranged = options->rangeOffset > 0 || options->rangeLength != ARCHIVE_TO_END;
+    w24ArchiveInfo info;
+    describeArchive(&info, options, ranged ? plainTarSize(baseDir, list) : -1);
+
+    char archiveName[PATH_MAX];
+    snprintf(archiveName, sizeof(archiveName), "%s%s", baseName, codecs[ARCHIVE_CODEC_NONE].suffix);
+    if (sendArchiveBegin(stream->reply, archiveName, &info) == -1) {
+        return -1;
+    }
+
+    static const char zeros[TAR_BLOCK_LEN * 2];
+    w24Buffer pending;
+    bufferInit(&pending);
+    int filesAdded = 0;
+    for (int i = 0; i < list->count && !stream->failed; i++) {
+        struct stat st;
+        int fd = openMember(baseDir, &list->members[i], &st);
+        if (fd == -1) {
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || appendTarHeader(&pending, list->members[i].name, &st) == -1) {
+            close(fd);
+            continue;
+        }
+
+        stream->failed = streamBytes(stream, pending.data, pending.length) == -1 ||
+                         streamFileBytes(stream, fd, st.st_size) == -1;
+        close(fd);
+        pending.length = 0;
+        bufferAppend(&pending, zeros, (TAR_BLOCK_LEN - st.st_size % TAR_BLOCK_LEN) % TAR_BLOCK_LEN);
+        countInput(options, &st);
+        filesAdded++;
+    }
+
+    // Two zero blocks end the archive
+    if (!stream->failed && bufferAppend(&pending, zeros, sizeof(zeros)) == 0) {
+        streamBytes(stream, pending.data, pending.length);
+    }
+    bufferFree(&pending);
+    return endStream(stream) == -1 ? -1 : filesAdded;
+}
+
+//Where one member's compressed bytes go: into the block being built while it is small enough to cache,
+//straight to the client once it outgrows that. Workers build blocks with no stream and no limit.
+typedef struct memberSink {
+    archiveStream *stream;
+    w24Buffer block;
+    size_t limit;
+    int spilled;
+} memberSink;
+
+static ssize_t memberWrite(struct archive *a, void *clientData, const void *buffer, size_t length) {
+    memberSink *sink = clientData;
+    (void)a;
+
+    if (!sink->spilled && sink->block.length + length <= sink->limit &&
+        bufferAppend(&sink->block, buffer, length) == 0) {
+        return length;
+    }
+    if (!sink->stream) {
+        return -1;
+    }
+    if (!sink->spilled) {
+        sink->spilled = 1;
+        if (streamBytes(sink->stream, sink->block.data, sink->block.length) == -1) {
+            sink->stream->failed = 1;
+            return -1;
+        }
+    }
+    if (streamBytes(sink->stream, buffer, length) == -1) {
+        sink->stream->failed = 1;
+        return -1;
+    }
+    return length;
+}
+
+//gzipStream output for a member compressed on several threads.
+static int gzipToSink(void *context, const void *data, size_t length) {
+    return memberWrite(NULL, context, data, length) == (ssize_t)length ? 0 : -1;
+}
+
+//What a member's bytes are fed to: libarchive, or the parallel gzip compressor.
+typedef struct memberWriter {
+    struct archive *a;
+    gzipStream *gzip;
+} memberWriter;
+
+static int writeMemberData(memberWriter *writer, const void *data, size_t length) {
+    if (writer->gzip) {
+        return gzipStreamWrite(writer->gzip, data, length);
+    }
+    return archive_write_data(writer->a, data, length) == (ssize_t)length ? 0 : -1;
+}
+
+//Compress prefix, then size bytes of fd (zeros if the file shrank), then zeros up to the next tar block as
+//one self-contained gzip member or zstd/lz4 frame. libarchive's raw format writes the bytes as given. With
+//threads > 1 (members too big to cache), gzip members are deflated in parallel blocks and zstd frames use
+//zstd's workers.
+static int compressMember(memberSink *sink, const archiveOptions *options, const w24Buffer *prefix, int fd,
+                          off_t size, int threads) {
+    memberWriter writer = { NULL, NULL };
+    struct archive_entry *entry = NULL;
+    int failed = 0;
+    if (options->codec == ARCHIVE_CODEC_GZIP && threads > 1 &&
+        (writer.gzip = gzipStreamNew(threads, options->level, gzipToSink, sink)) != NULL) {
+        failed = writeMemberData(&writer, prefix->data, prefix->length) == -1;
+    } else {
+        writer.a = archive_write_new();
+        addCodecFilter(writer.a, options->codec);
+        if (options->level != ARCHIVE_LEVEL_DEFAULT) {
+            char level[16];
+            snprintf(level, sizeof(level), "%d", options->level);
+            archive_write_set_filter_option(writer.a, NULL, "compression-level", level);
+        }
+        if (options->codec == ARCHIVE_CODEC_ZSTD && threads > 1) {
+            char workers[16];
+            snprintf(workers, sizeof(workers), "%d", threads);
+            archive_write_set_filter_option(writer.a, "zstd", "threads", workers);
+        }
+        archive_write_set_format_raw(writer.a);
+        archive_write_set_bytes_per_block(writer.a, 0);
+        if (archive_write_open(writer.a, sink, NULL, memberWrite, NULL) != ARCHIVE_OK) {
+            fprintf(stderr, "Failed to open archive member: %s\n", archive_error_string(writer.a));
+            archive_write_free(writer.a);
+            return -1;
+        }
+        entry = archive_entry_new();
+        archive_entry_set_filetype(entry, AE_IFREG);
+        failed = archive_write_header(writer.a, entry) != ARCHIVE_OK ||
+                 writeMemberData(&writer, prefix->data, prefix->length) == -1;
+    }
+
+    char buffer[65536];
+    off_t done = 0;
+    while (!failed && done < size) {
+        size_t want = size - done < (off_t)sizeof(buffer) ? (size_t)(size - done) : sizeof(buffer);
+        ssize_t length = fd == -1 ? 0 : read(fd, buffer, want);
+        if (length <= 0) {
+            memset(buffer, 0, want); // Shrank while being archived: keep the size the header promised
+            length = want;
+            fd = -1;
+        }
+        failed = writeMemberData(&writer, buffer, length) == -1;
+        done += length;
+    }
+    size_t padding = (TAR_BLOCK_LEN - size % TAR_BLOCK_LEN) % TAR_BLOCK_LEN;
+    if (!failed && padding > 0) {
+        memset(buffer, 0, padding);
+        failed = writeMemberData(&writer, buffer, padding) == -1;
+    }
+
+    if (writer.gzip) {
+        failed |= gzipStreamFinish(writer.gzip) == -1;
+        gzipStreamFree(writer.gzip);
+    } else {
+        failed |= archive_write_close(writer.a) != ARCHIVE_OK;
+        archive_entry_free(entry);
+        archive_write_free(writer.a);
+    }
+    return failed || (sink->stream && sink->stream->failed) ? -1 : 0;
+}
+
+//Members opened ahead of the one being sent, and the most file bytes they may hold between them.
+#define PIPELINE_DEPTH 16
+#define PIPELINE_MAX_BYTES (64 * 1024 * 1024)
+
+//Reading ahead of a member larger than this stops here; sequential readahead takes over from there.
+#define PREFETCH_MAX_BYTES (4 * 1024 * 1024)
+
+#define JOB_INLINE 0  // Compressed by the writer when its turn comes (too big to cache, or no workers)
+#define JOB_QUEUED 1  // Waiting for a worker
+#define JOB_RUNNING 2
+#define JOB_DONE 3
+
+//One member in the pipeline, from opening its file to sending its bytes.
+typedef struct memberJob {
+    int fd;
+    struct stat st;
+    blockKey key;
+    cachedBlock *block; // A cache hit: nothing to compress
+    w24Buffer header;
+    memberSink sink;    // A worker's result
+    int state;
+    int failed;
+} memberJob;
+
+//Reader, compressors and writer of one archive. The thread streaming the archive opens members in order
+//(reader: posix_fadvise starts their reads), workers compress queued members into memory, and the same
+//thread sends finished members in order (writer). At most PIPELINE_DEPTH members and PIPELINE_MAX_BYTES of
+//their files are in flight, which bounds the memory one archive holds.
+typedef struct memberPipeline {
+    const archiveOptions *options;
+    memberJob jobs[PIPELINE_DEPTH];
+    int depth;                        // Members opened ahead: 1 without prefetch
+    unsigned long head;               // Next member to send
+    unsigned long tail;               // Next slot to fill
+    unsigned long long pendingBytes;  // File bytes of [head, tail)
+    int numThreads;
+    pthread_t threads[PIPELINE_DEPTH];
+    int started;
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady; // Workers wait for queued members
+    pthread_cond_t jobDone;  // The writer waits for the head member
+    int stopping;
+} memberPipeline;
+
+static void *memberWorker(void *arg) {
+    memberPipeline *pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (1) {
+        memberJob *job = NULL;
+        for (unsigned long i = pipeline->head; i < pipeline->tail && !job; i++) {
+            if (pipeline->jobs[i % PIPELINE_DEPTH].state == JOB_QUEUED) {
+                job = &pipeline->jobs[i % PIPELINE_DEPTH];
+            }
+        }
+        if (!job) {
+            if (pipeline->stopping) {
+                break;
+            }
+            pthread_cond_wait(&pipeline->jobReady, &pipeline->lock);
+            continue;
+        }
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        int failed = compressMember(&job->sink, pipeline->options, &job->header, job->fd, job->st.st_size, 1);
+
+        pthread_mutex_lock(&pipeline->lock);
+        job->failed = failed;
+        job->state = JOB_DONE;
+        pthread_cond_broadcast(&pipeline->jobDone);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+//Open the next member into the tail slot: a cache hit is ready at once, a small miss is queued for the
+//workers, anything else waits for the writer. Its read starts in the background either way. Returns -1 if
+//the member is skipped.
+static int prepareMember(memberPipeline *pipeline, const char *baseDir, const archiveMember *member) {
+    const archiveOptions *options = pipeline->options;
+    memberJob *job = &pipeline->jobs[pipeline->tail % PIPELINE_DEPTH];
+    job->fd = openMember(baseDir, member, &job->st);
+    if (job->fd == -1) {
+        return -1;
+    }
+    job->header.length = 0;
+    if (!S_ISREG(job->st.st_mode) || appendTarHeader(&job->header, member->name, &job->st) == -1) {
+        close(job->fd);
+        return -1;
+    }
+
+    const struct stat *st = &job->st;
+    job->key = (blockKey){ st->st_dev, st->st_ino, st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+                           st->st_ctim.tv_sec, st->st_ctim.tv_nsec, options->codec, options->level, member->name };
+    job->block = blockCacheGet(options->blocks, &job->key);
+    job->sink.block.length = 0;
+    job->sink.spilled = 0;
+    job->failed = 0;
+    job->state = JOB_INLINE;
+    if (!job->block) {
+        if (pipeline->depth > 1) {
+            posix_fadvise(job->fd, 0, st->st_size < PREFETCH_MAX_BYTES ? st->st_size : PREFETCH_MAX_BYTES,
+                          POSIX_FADV_WILLNEED);
+        }
+        if (pipeline->numThreads > 0 && (size_t)st->st_size <= options->blocks->maxBlock) {
+            job->state = JOB_QUEUED;
+        }
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->tail++;
+    pipeline->pendingBytes += st->st_size;
+    if (job->state == JOB_QUEUED) {
+        pthread_cond_signal(&pipeline->jobReady);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    countInput(options, st);
+    return 0;
+}
+
+//Send the head member once it is ready and free its slot. A worker's block is added to the cache; a member
+//compressed here goes out as it is produced if it outgrows the cache limit.
+static void sendHeadMember(memberPipeline *pipeline, archiveStream *stream) {
+    const archiveOptions *options = pipeline->options;
+    memberJob *job = &pipeline->jobs[pipeline->head % PIPELINE_DEPTH];
+
+    pthread_mutex_lock(&pipeline->lock);
+    if (stream->failed) {
+        // Nobody wants the rest: members no worker has started are dropped
+        for (unsigned long i = pipeline->head; i < pipeline->tail; i++) {
+            if (pipeline->jobs[i % PIPELINE_DEPTH].state == JOB_QUEUED) {
+                pipeline->jobs[i % PIPELINE_DEPTH].state = JOB_INLINE;
+            }
+        }
+    }
+    while (job->state == JOB_QUEUED || job->state == JOB_RUNNING) {
+        pthread_cond_wait(&pipeline->jobDone, &pipeline->lock);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+
+    if (stream->failed) {
+        // Just release it
+    } else if (job->block) {
+        if (streamBytes(stream, job->block->data, job->block->length) == -1) {
+            stream->failed = 1;
+        }
+    } else if (job->state == JOB_DONE) {
+        if (!job->failed) {
+            if (streamBytes(stream, job->sink.block.data, job->sink.block.length) == -1) {
+                stream->failed = 1;
+            }
+            blockCachePut(options->blocks, &job->key, job->sink.block.data, job->sink.block.length);
+        }
+    } else {
+        memberSink sink = { stream, { NULL, 0, 0 }, options->blocks->maxBlock, 0 };
+        int result = compressMember(&sink, options, &job->header, job->fd, job->st.st_size,
+                                    job->st.st_size > (off_t)options->blocks->maxBlock ? options->threads : 1);
+        if (result == -1 && sink.spilled) {
+            stream->failed = 1; // Part of the member is already out
+        } else if (result == 0 && !sink.spilled) {
+            if (streamBytes(stream, sink.block.data, sink.block.length) == -1) {
+                stream->failed = 1;
+            }
+            blockCachePut(options->blocks, &job->key, sink.block.data, sink.block.length);
+        }
+        bufferFree(&sink.block);
+    }
+
+    if (job->block) {
+        blockCacheRelease(options->blocks, job->block);
+        job->block = NULL;
+    }
+    close(job->fd);
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->head++;
+    pipeline->pendingBytes -= job->st.st_size;
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+//Compressed archives assembled from per-file blocks: every file becomes one compressed member, looked up
+//in the block cache by inode, size, times and name first, so only files not archived before are
+//compressed. Members are read ahead and compressed on options->threads workers while earlier ones are
+//sent; then one member for the end-of-archive blocks. They are concatenated into the stream in list order.
+static int streamMembers(archiveStream *stream, const char *baseDir, const archiveList *list, const char *baseName,
+                         const archiveOptions *options) {
+    w24ArchiveInfo info;
+    describeArchive(&info, options, -1);
+    char archiveName[PATH_MAX];
+    snprintf(archiveName, sizeof(archiveName), "%s%s", baseName, codecs[options->codec].suffix);
+    if (sendArchiveBegin(stream->reply, archiveName, &info) == -1) {
+        return -1;
+    }
+
+    memberPipeline *pipeline = calloc(1, sizeof(memberPipeline));
+    if (!pipeline) {
+        return endStream(stream) == -1 ? -1 : 0;
+    }
+    pipeline->options = options;
+    pipeline->depth = options->prefetch ? PIPELINE_DEPTH : 1;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->jobReady, NULL);
+    pthread_cond_init(&pipeline->jobDone, NULL);
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        bufferInit(&pipeline->jobs[i].header);
+        bufferInit(&pipeline->jobs[i].sink.block);
+        pipeline->jobs[i].sink.limit = SIZE_MAX;
+    }
+    // One thread compresses inline; more run as workers beside the writer
+    int workers = options->threads > 1 ? options->threads : 0;
+    for (int i = 0; i < workers && i < PIPELINE_DEPTH; i++) {
+        if (pthread_create(&pipeline->threads[i], NULL, memberWorker, pipeline) != 0) {
+            break;
+        }
+        pipeline->started++;
+    }
+    pipeline->numThreads = pipeline->started;
+
+    int filesAdded = 0;
+    for (int i = 0; i < list->count && !stream->failed; i++) {
+        // Keep the window full, sending the oldest member whenever it is
+        while (pipeline->tail - pipeline->head >= (unsigned long)pipeline->depth ||
+               (pipeline->tail > pipeline->head && pipeline->pendingBytes >= PIPELINE_MAX_BYTES)) {
+            sendHeadMember(pipeline, stream);
+        }
+        if (prepareMember(pipeline, baseDir, &list->members[i]) == 0) {
+            filesAdded++;
+        }
+    }
+    while (pipeline->tail > pipeline->head) {
+        sendHeadMember(pipeline, stream);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopping = 1;
+    pthread_cond_broadcast(&pipeline->jobReady);
+    pthread_mutex_unlock(&pipeline->lock);
+    for (int i = 0; i < pipeline->started; i++) {
+        pthread_join(pipeline->threads[i], NULL);
+    }
+
+    // Two zero blocks end the archive
+    if (!stream->failed) {
+        static const char zeros[TAR_BLOCK_LEN * 2];
+        w24Buffer header;
+        bufferInit(&header);
+        memberSink sink = { stream, { NULL, 0, 0 }, options->blocks->maxBlock, 0 };
+        if (bufferAppend(&header, zeros, sizeof(zeros)) == -1 ||
+            compressMember(&sink, options, &header, -1, 0, 1) == -1 ||
+            (!sink.spilled && streamBytes(stream, sink.block.data, sink.block.length) == -1)) {
+            stream->failed = 1;
+        } else if (stream->tee) {
+            stream->tee->complete = 1;
+        }
+        bufferFree(&header);
+        bufferFree(&sink.block);
+    }
+
+    for (int i = 0; i < PIPELINE_DEPTH; i++) {
+        bufferFree(&pipeline->jobs[i].header);
+        bufferFree(&pipeline->jobs[i].sink.block);
+    }
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->jobReady);
+    pthread_cond_destroy(&pipeline->jobDone);
+    free(pipeline);
+    return endStream(stream) == -1 ? -1 : filesAdded;
+}
+
+int streamArchive(const w24Reply *reply, const char *baseDir, const archiveList *list, const char *baseName,
+                  const archiveOptions *options) {
+    archiveOptions defaults;
+    if (!options) {
+        archiveOptionsInit(&defaults);
+        options = &defaults;
+    }
+    archiveStream stream;
+    streamInit(&stream, reply, options);
+
+    if (options->codec == ARCHIVE_CODEC_NONE) {
+        stream.tee = NULL;
+        return streamPlainTar(&stream, baseDir, list, baseName, options);
+    }
+    if (options->blocks && archiveCodecSupported(options->codec)) {
+        return streamMembers(&stream, baseDir, list, baseName, options);
+    }
+
+    struct archive *a = archive_write_new();
+    int codec = setupCodec(a, &stream, options);
+
+    // Announce the archive so the client switches to reading archive data
+    w24ArchiveInfo info;
+    describeArchive(&info, options, -1);
+    char archiveName[PATH_MAX];
+    snprintf(archiveName, sizeof(archiveName), "%s%s", baseName, codecs[codec].suffix);
+    if (sendArchiveBegin(reply, archiveName, &info) == -1) {
+        archive_write_free(a);
+        gzipStreamFree(stream.gzip);
+        return -1;
+    }
+
+    archive_write_set_format_pax_restricted(a);
+    // No tape blocking: hand every compressed buffer to the socket as soon as it exists
+    archive_write_set_bytes_per_block(a, 0);
+
+    if (archive_write_open(a, &stream, NULL, archiveStreamWrite, archiveStreamClose) != ARCHIVE_OK) {
+        fprintf(stderr, "Failed to open archive stream: %s\n", archive_error_string(a));
+        archive_write_free(a);
+        gzipStreamFree(stream.gzip);
+        return -1;
+    }
+
+    int filesAdded = 0;
+    for (int i = 0; i < list->count && !stream.failed; i++) {
+        const archiveMember *member = &list->members[i];
+        struct stat st;
+        int fd = openMember(baseDir, member, &st);
+        if (fd == -1) {
+            continue;
+        }
+
+        // Without the access time, which changes as files are read, pax headers come out the same every time
+        struct archive_entry *entry = archive_entry_new();
+        archive_entry_copy_stat(entry, &st);
+        archive_entry_unset_atime(entry);
+        archive_entry_set_pathname(entry, member->name);
+
+        if (archive_write_header(a, entry) != ARCHIVE_OK) {
+            if (!stream.failed) {
+                fprintf(stderr, "Failed to write header to archive: %s\n", archive_error_string(a));
+            }
+            archive_entry_free(entry);
+            close(fd);
+            continue;
+        }
+
+        // Read and write file data to archive
+        char buff[65536];
+        ssize_t len;
+        while ((len = read(fd, buff, sizeof(buff))) > 0) {
+            if (archive_write_data(a, buff, len) != len) {
+                if (!stream.failed) {
+                    fprintf(stderr, "Failed to write file data to archive: %s\n", archive_error_string(a));
+                }
+                break;
+            }
+        }
+
+        close(fd);
+        archive_entry_free(entry);
+        countInput(options, &st);
+        filesAdded++;
+    }
+
+    archive_write_close(a);
+    archive_write_free(a);
+    gzipStreamFree(stream.gzip);
+
+    return endStream(&stream) == -1 ? -1 : filesAdded;
+}
@@ -0,0 +1,91 @@
+//Streaming tar.gz replies shared by serverw24, mirror1 and mirror2.
+#ifndef W24ARCHIVE_H
+#define W24ARCHIVE_H
+
+#include <limits.h>
+
+#include "w24proto.h"
+#include "w24blocks.h"
+
+//A file selected for an archive, by name relative to the served directory. Its header is taken from an
+//fstat of the opened file, so size and mode match the bytes actually archived.
+typedef struct archiveMember {
+    char *name;
+} archiveMember;
+
+typedef struct archiveList {
+    archiveMember *members;
+    int count;
+    int capacity;
+} archiveList;
+
+void archiveListInit(archiveList *list);
+int archiveListAdd(archiveList *list, const char *name);
+void archiveListFree(archiveList *list);
+//Put the members in name order, so the same set of files always gives the same archive bytes.
+void archiveListSort(archiveList *list);
+//Returns -1 on allocation failure, leaving copy empty.
+int archiveListCopy(archiveList *copy, const archiveList *list);
+
+//Compression codecs an archive can be sent with.
+#define ARCHIVE_CODEC_NONE 0
+#define ARCHIVE_CODEC_GZIP 1
+#define ARCHIVE_CODEC_ZSTD 2
+#define ARCHIVE_CODEC_LZ4 3
+#define ARCHIVE_NUM_CODECS 4
+
+//The codec's own default level.
+#define ARCHIVE_LEVEL_DEFAULT -1
+
+//A copy of the compressed stream written to a file as it is sent (the result cache, w24cache.h).
+typedef struct archiveTee {
+    int fd;
+    int failed;               // A write failed; the copy is incomplete
+    int complete;             // The whole archive was written, even if the client left or took only a range
+    unsigned long long bytes;
+} archiveTee;
+
+//rangeLength for the rest of the archive.
+#define ARCHIVE_TO_END ULLONG_MAX
+
+//Per-request archive settings; NULL means the defaults (gzip at its default level, one thread, all of it).
+typedef struct archiveOptions {
+    int threads; // Compression threads: members compress side by side (with blocks), and a large file or a
+                 // whole stream is deflated in parallel blocks (w24gzip.h) or by zstd's workers
+    int codec;   // ARCHIVE_CODEC_*
+    int level;
+    archiveTee *tee; // NULL, or where to copy the compressed bytes (not used by uncompressed archives)
+    blockCache *blocks; // NULL, or compressed members to reuse; members are then compressed on the threads
+    int prefetch;       // Open members and start reading them ahead of the one being compressed
+    const char *resultId; // NULL, or the id the client can fetch the archive again by (w24proto.h)
+    unsigned long long rangeOffset; // Only these bytes of the archive go to the client
+    unsigned long long rangeLength;
+    unsigned long long *inputBytes; // NULL, or where to add the size of every member archived
+} archiveOptions;
+
+void archiveOptionsInit(archiveOptions *options);
+
+//Pick the codec for a request from the client's preferences, "codec[:level][,codec[:level]...]" best first:
+//the first one this build can write wins, names it does not know are skipped, and gzip is used if none is
+//left. Returns -1 if a level is out of range for its codec.
+int archiveSelectCodec(const char *preferences, archiveOptions *options);
+const char *archiveCodecName(int codec);
+//".tar", ".tar.gz"... as streamArchive names the archive.
+const char *archiveCodecSuffix(int codec);
+//Whether the linked libarchive can write the codec.
+int archiveCodecSupported(int codec);
+//The codec of a compressed archive starting with these bytes, by its magic number; ARCHIVE_CODEC_NONE if
+//none matches.
+int archiveCodecDetect(const void *head, size_t length);
+
+//Compress the listed files from baseDir into a tar (tar.gz, tar.zst, tar.lz4 by codec) and stream it to the
+//client as it is produced (see w24proto.h for the framing). The client is told the file name: baseName plus
+//the suffix of the codec actually used. The members go in list order and carry no access times or gzip
+//timestamps, so the same files and options always give the same bytes, and a range of them can be sent
+//again by producing the archive anew. Production stops once the range is out, unless the tee still wants
+//the rest; it also carries on into the tee if the client goes away. Returns the number of files archived,
+//or -1 if the client went away.
+int streamArchive(const w24Reply *reply, const char *baseDir, const archiveList *list, const char *baseName,
+                  const archiveOptions *options);
+
+#endif
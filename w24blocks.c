@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "w24blocks.h"
+
+#define INITIAL_BUCKETS 1024
+
+//FNV-1a over the key fields and the name.
+static uint64_t hashKey(const blockKey *key) {
+    int64_t fields[9] = { (int64_t)key->dev, (int64_t)key->ino, key->size, key->mtimeSec, key->mtimeNsec,
+                          key->ctimeSec, key->ctimeNsec, key->codec, key->level };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *bytes = (const unsigned char *)fields;
+    for (size_t i = 0; i < sizeof(fields); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    for (const unsigned char *p = (const unsigned char *)key->name; *p; p++) {
+        hash = (hash ^ *p) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int sameKey(const blockKey *a, const blockKey *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->mtimeSec == b->mtimeSec &&
+           a->mtimeNsec == b->mtimeNsec && a->ctimeSec == b->ctimeSec && a->ctimeNsec == b->ctimeNsec &&
+           a->codec == b->codec && a->level == b->level && strcmp(a->name, b->name) == 0;
+}
+
+int blockCacheInit(blockCache *cache, size_t budget) {
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+    // One block may not crowd out more than a sixteenth of the cache
+    cache->maxBlock = budget / 16;
+    cache->numBuckets = INITIAL_BUCKETS;
+    cache->buckets = calloc(cache->numBuckets, sizeof(cachedBlock *));
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache->buckets ? 0 : -1;
+}
+
+void blockCacheFree(blockCache *cache) {
+    cachedBlock *block = cache->head;
+    while (block) {
+        cachedBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+static void unlinkLru(blockCache *cache, cachedBlock *block) {
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        cache->head = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    } else {
+        cache->tail = block->prev;
+    }
+    block->prev = block->next = NULL;
+}
+
+static void pushLru(blockCache *cache, cachedBlock *block) {
+    block->prev = NULL;
+    block->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = block;
+    } else {
+        cache->tail = block;
+    }
+    cache->head = block;
+}
+
+static cachedBlock **findSlot(blockCache *cache, const blockKey *key, uint64_t hash) {
+    cachedBlock **slot = &cache->buckets[hash & (cache->numBuckets - 1)];
+    while (*slot && ((*slot)->hash != hash || !sameKey(&(*slot)->key, key))) {
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+//Double the buckets once chains would average more than one block.
+static void growBuckets(blockCache *cache) {
+    size_t numBuckets = cache->numBuckets * 2;
+    cachedBlock **buckets = calloc(numBuckets, sizeof(cachedBlock *));
+    if (!buckets) {
+        return; // Longer chains, still correct
+    }
+    for (cachedBlock *block = cache->head; block; block = block->next) {
+        cachedBlock **bucket = &buckets[block->hash & (numBuckets - 1)];
+        block->chain = *bucket;
+        *bucket = block;
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->numBuckets = numBuckets;
+}
+
+//Take the least recently used blocks out until the cache fits; ones still being sent are freed on release.
+static void evict(blockCache *cache) {
+    while (cache->total > cache->budget && cache->tail) {
+        cachedBlock *block = cache->tail;
+        *findSlot(cache, &block->key, block->hash) = block->chain;
+        unlinkLru(cache, block);
+        cache->total -= block->length;
+        cache->count--;
+        block->evicted = 1;
+        if (block->refs == 0) {
+            free(block);
+        }
+    }
+}
+
+cachedBlock *blockCacheGet(blockCache *cache, const blockKey *key) {
+    uint64_t hash = hashKey(key);
+    pthread_mutex_lock(&cache->lock);
+    cachedBlock *block = *findSlot(cache, key, hash);
+    if (block) {
+        block->refs++;
+        unlinkLru(cache, block);
+        pushLru(cache, block);
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return block;
+}
+
+void blockCacheRelease(blockCache *cache, cachedBlock *block) {
+    pthread_mutex_lock(&cache->lock);
+    int release = --block->refs == 0 && block->evicted;
+    pthread_mutex_unlock(&cache->lock);
+    if (release) {
+        free(block);
+    }
+}
+
+void blockCachePut(blockCache *cache, const blockKey *key, const void *data, size_t length) {
+    if (length > cache->maxBlock) {
+        return;
+    }
+
+    // Header, name and data in one allocation
+    size_t nameLength = strlen(key->name) + 1;
+    cachedBlock *block = malloc(sizeof(cachedBlock) + nameLength + length);
+    if (!block) {
+        return;
+    }
+    memset(block, 0, sizeof(*block));
+    char *name = (char *)(block + 1);
+    memcpy(name, key->name, nameLength);
+    block->key = *key;
+    block->key.name = name;
+    block->hash = hashKey(key);
+    block->data = (unsigned char *)name + nameLength;
+    block->length = length;
+    memcpy(block->data, data, length);
+
+    pthread_mutex_lock(&cache->lock);
+    cachedBlock **slot = findSlot(cache, key, block->hash);
+    if (*slot) {
+        pthread_mutex_unlock(&cache->lock);
+        free(block);
+        return;
+    }
+    *slot = block;
+    pushLru(cache, block);
+    cache->total += length;
+    cache->count++;
+    if (cache->count > cache->numBuckets) {
+        growBuckets(cache);
+    }
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
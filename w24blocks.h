@@ -0,0 +1,64 @@
+//In-memory LRU cache of compressed archive members: each block is one file's tar header, data and padding,
+//compressed as a complete gzip member / zstd frame / lz4 frame, so blocks can be concatenated into a valid
+//compressed tar stream. Archives of overlapping file sets then only compress the files not seen before.
+#ifndef W24BLOCKS_H
+#define W24BLOCKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define DEFAULT_BLOCK_CACHE_MB 256
+
+//What a block was made from. The name is part of the key because the tar header holds it.
+typedef struct blockKey {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    int64_t ctimeSec;
+    int64_t ctimeNsec;
+    int codec;
+    int level;
+    const char *name;
+} blockKey;
+
+typedef struct cachedBlock {
+    struct cachedBlock *prev;  // LRU list, most recently used first
+    struct cachedBlock *next;
+    struct cachedBlock *chain; // Hash bucket
+    uint64_t hash;
+    blockKey key;              // key.name points into the block's own allocation
+    int refs;                  // Senders still using it; an evicted block is freed at the last release
+    int evicted;
+    size_t length;
+    unsigned char *data;
+} cachedBlock;
+
+typedef struct blockCache {
+    cachedBlock **buckets;
+    size_t numBuckets;
+    size_t count;
+    cachedBlock *head;
+    cachedBlock *tail;
+    size_t total;
+    size_t budget;
+    size_t maxBlock; // Larger blocks are sent but not kept
+    unsigned long hits;
+    unsigned long misses;
+    pthread_mutex_t lock;
+} blockCache;
+
+int blockCacheInit(blockCache *cache, size_t budget);
+void blockCacheFree(blockCache *cache);
+
+//Look a block up and hold it until blockCacheRelease. Returns NULL on a miss.
+cachedBlock *blockCacheGet(blockCache *cache, const blockKey *key);
+void blockCacheRelease(blockCache *cache, cachedBlock *block);
+//Store a copy of a block, evicting least recently used ones past the budget. Blocks over maxBlock, or
+//already cached by a concurrent request, are not stored.
+void blockCachePut(blockCache *cache, const blockKey *key, const void *data, size_t length);
+
+#endif
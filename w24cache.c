@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "w24cache.h"
+
+//128-bit FNV-1a: wide enough that two different file sets never share a key in practice.
+#define FNV128_OFFSET ((((unsigned __int128)0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL)
+#define FNV128_PRIME ((((unsigned __int128)1) << 88) | 0x13b)
+
+static void hashBytes(unsigned __int128 *hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        *hash ^= bytes[i];
+        *hash *= FNV128_PRIME;
+    }
+}
+
+static int compareMemberNames(const void *a, const void *b) {
+    return strcmp((*(const archiveMember *const *)a)->name, (*(const archiveMember *const *)b)->name);
+}
+
+void cacheKey(const char *baseDir, const archiveList *list, const archiveOptions *options, char *key) {
+    unsigned __int128 hash = FNV128_OFFSET;
+    // How the archive is put together changes its bytes as much as the codec does: parallel compression, and
+    // per-file members with the size above which a member is compressed on the threads
+    long long members = options->blocks && archiveCodecSupported(options->codec) ? (long long)options->blocks->maxBlock : -1;
+    long long settings[4] = { options->codec, options->level, options->threads > 1, members };
+    hashBytes(&hash, settings, sizeof(settings));
+
+    // Name order, so the same set of files gives the same key whatever order the index listed them in
+    const archiveMember **sorted = malloc(sizeof(archiveMember *) * (list->count ? list->count : 1));
+    for (int i = 0; sorted && i < list->count; i++) {
+        sorted[i] = &list->members[i];
+    }
+    if (sorted) {
+        qsort(sorted, list->count, sizeof(archiveMember *), compareMemberNames);
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        const archiveMember *member = sorted ? sorted[i] : &list->members[i];
+        char filePath[PATH_MAX * 2];
+        snprintf(filePath, sizeof(filePath), "%s/%s", baseDir, member->name);
+
+        struct statx stx;
+        int64_t attributes[6] = { -1, -1, -1, -1, -1, -1 };
+        if (statx(AT_FDCWD, filePath, 0, STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &stx) == 0) {
+            attributes[0] = stx.stx_ino;
+            attributes[1] = stx.stx_size;
+            attributes[2] = stx.stx_mtime.tv_sec;
+            attributes[3] = stx.stx_mtime.tv_nsec;
+            attributes[4] = stx.stx_ctime.tv_sec;
+            attributes[5] = stx.stx_ctime.tv_nsec;
+        }
+        hashBytes(&hash, member->name, strlen(member->name) + 1);
+        hashBytes(&hash, attributes, sizeof(attributes));
+    }
+    free(sorted);
+
+    snprintf(key, CACHE_KEY_LEN + 1, "%016llx%016llx", (unsigned long long)(hash >> 64), (unsigned long long)hash);
+}
+
+static cacheEntry *findEntry(w24Cache *cache, const char *key) {
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->entries[i].key, key) == 0) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static int addEntry(w24Cache *cache, const char *key, unsigned long long size) {
+    if (cache->count == cache->capacity) {
+        int capacity = cache->capacity ? cache->capacity * 2 : 64;
+        cacheEntry *entries = realloc(cache->entries, sizeof(cacheEntry) * capacity);
+        if (!entries) {
+            return -1;
+        }
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+    cacheEntry *entry = &cache->entries[cache->count++];
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+    entry->size = size;
+    entry->lastUsed = ++cache->clock;
+    cache->total += size;
+    return 0;
+}
+
+//Drop least recently used entries until the cache fits its budget. Clients still sending an evicted
+//entry keep their open descriptor. Called with the lock held.
+static void evict(w24Cache *cache) {
+    while (cache->total > cache->budget && cache->count > 0) {
+        int oldest = 0;
+        for (int i = 1; i < cache->count; i++) {
+            if (cache->entries[i].lastUsed < cache->entries[oldest].lastUsed) {
+                oldest = i;
+            }
+        }
+        unlinkat(cache->dirFd, cache->entries[oldest].key, 0);
+        cache->total -= cache->entries[oldest].size;
+        cache->entries[oldest] = cache->entries[--cache->count];
+    }
+}
+
+static int isKey(const char *name) {
+    size_t length = strspn(name, "0123456789abcdef");
+    return length == CACHE_KEY_LEN && name[length] == '\0';
+}
+
+static int compareEntryAge(const void *a, const void *b) {
+    unsigned long long ageA = ((const cacheEntry *)a)->lastUsed, ageB = ((const cacheEntry *)b)->lastUsed;
+    return ageA < ageB ? -1 : ageA > ageB;
+}
+
+int cacheInit(w24Cache *cache, const char *dir, unsigned long long budget) {
+    memset(cache, 0, sizeof(*cache));
+    snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    cache->budget = budget;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    mkdir(dir, 0700);
+    cache->dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cache->dirFd == -1) {
+        fprintf(stderr, "Failed to open cache directory %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    // Entries of an earlier run, ordered by their last use (mtime) so the oldest go first
+    DIR *listing = fdopendir(dup(cache->dirFd));
+    struct dirent *dirEntry;
+    while (listing && (dirEntry = readdir(listing)) != NULL) {
+        struct stat st;
+        if (isKey(dirEntry->d_name) && fstatat(cache->dirFd, dirEntry->d_name, &st, 0) == 0 &&
+            addEntry(cache, dirEntry->d_name, st.st_size) == 0) {
+            cache->entries[cache->count - 1].lastUsed = st.st_mtime;
+        }
+    }
+    if (listing) {
+        closedir(listing);
+    }
+    qsort(cache->entries, cache->count, sizeof(cacheEntry), compareEntryAge);
+    for (int i = 0; i < cache->count; i++) {
+        cache->entries[i].lastUsed = i + 1;
+    }
+    cache->clock = cache->count;
+    evict(cache);
+    return 0;
+}
+
+void cacheFree(w24Cache *cache) {
+    if (cache->dirFd != -1) {
+        close(cache->dirFd);
+    }
+    free(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+int cacheServe(w24Cache *cache, const w24Reply *reply, const char *key, const char *baseName,
+               unsigned long long offset, unsigned long long length) {
+    pthread_mutex_lock(&cache->lock);
+    cacheEntry *entry = findEntry(cache, key);
+    int fd = entry ? openat(cache->dirFd, key, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd != -1) {
+        entry->lastUsed = ++cache->clock;
+        cache->hits++;
+        futimens(fd, NULL); // The mtime carries the last use over to the next run
+    } else {
+        if (entry) {
+            // Deleted behind our back: forget it so the miss can store it again
+            cache->total -= entry->size;
+            *entry = cache->entries[--cache->count];
+        }
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (fd == -1) {
+        return 0;
+    }
+
+    // The codec is read back from the entry, so an id can be served without knowing the query it answered
+    struct stat st;
+    unsigned char head[8];
+    ssize_t headLength = pread(fd, head, sizeof(head), 0);
+    if (fstat(fd, &st) == -1 || headLength == -1) {
+        close(fd);
+        return -1;
+    }
+    char archiveName[PATH_MAX];
+    snprintf(archiveName, sizeof(archiveName), "%s%s", baseName,
+             archiveCodecSuffix(archiveCodecDetect(head, headLength)));
+
+    w24ArchiveInfo info;
+    memset(&info, 0, sizeof(info));
+    snprintf(info.resultId, sizeof(info.resultId), "%s", key);
+    info.offset = offset;
+    info.size = st.st_size;
+    unsigned long long size = st.st_size;
+    offset = offset < size ? offset : size;
+    length = length < size - offset ? length : size - offset;
+
+    int result = sendArchiveBegin(reply, archiveName, &info) == -1 ||
+                 sendArchiveFile(reply, fd, offset, length) == -1 || sendArchiveEnd(reply) == -1 ? -1 : 1;
+    close(fd);
+    return result;
+}
+
+int cacheBegin(w24Cache *cache, archiveTee *tee) {
+    tee->failed = 0;
+    tee->complete = 0;
+    tee->bytes = 0;
+    tee->fd = openat(cache->dirFd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+    return tee->fd == -1 ? -1 : 0;
+}
+
+void cacheFinish(w24Cache *cache, const char *key, archiveTee *tee) {
+    if (tee->complete && !tee->failed && tee->bytes <= cache->budget) {
+        pthread_mutex_lock(&cache->lock);
+        // A concurrent miss of the same query may have stored it first; then this copy is dropped
+        char procPath[64];
+        snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", tee->fd);
+        if (!findEntry(cache, key) && linkat(AT_FDCWD, procPath, cache->dirFd, key, AT_SYMLINK_FOLLOW) == 0) {
+            if (addEntry(cache, key, tee->bytes) == -1) {
+                unlinkat(cache->dirFd, key, 0);
+            }
+            evict(cache);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    close(tee->fd);
+    tee->fd = -1;
+}
@@ -0,0 +1,60 @@
+//On-disk cache of compressed archive replies, keyed by the codec and a fingerprint of the matching files.
+#ifndef W24CACHE_H
+#define W24CACHE_H
+
+#include <pthread.h>
+
+#include "w24archive.h"
+#include "w24proto.h"
+
+//A key is a 128-bit hash, written as hex; it is also the entry's file name in the cache directory and the
+//result id clients fetch the archive again by.
+#define CACHE_KEY_LEN W24_RESULT_ID_LEN
+
+#define DEFAULT_CACHE_MB 1024
+
+typedef struct cacheEntry {
+    char key[CACHE_KEY_LEN + 1];
+    unsigned long long size;
+    unsigned long long lastUsed; // Cache clock at the last hit or store; the smallest is evicted first
+} cacheEntry;
+
+typedef struct w24Cache {
+    char dir[PATH_MAX];
+    int dirFd;
+    unsigned long long budget; // Bytes of entries kept on disk
+    unsigned long long total;
+    unsigned long long clock;
+    cacheEntry *entries;
+    int count;
+    int capacity;
+    unsigned long hits;
+    unsigned long misses;
+    pthread_mutex_t lock;
+} w24Cache;
+
+//Open or create the cache directory and adopt the entries already in it, oldest first, evicting down to
+//budget bytes. Returns -1 if the directory is unusable.
+int cacheInit(w24Cache *cache, const char *dir, unsigned long long budget);
+void cacheFree(w24Cache *cache);
+
+//Key for the archive of the listed files from baseDir with the given options: the codec, the level, whether
+//it is compressed on several threads and from per-file members, which all change the bytes. It covers every
+//member's name, inode, size, ctime and mtime (to the nanosecond), in name order. Any change to a matching
+//file, or to which files match, gives a new key, so stale entries are never served and just age out.
+void cacheKey(const char *baseDir, const archiveList *list, const archiveOptions *options, char *key);
+
+//Serve a hit: announce baseName plus the suffix of the stored archive's codec, with the key as its result id,
+//and send length bytes (ARCHIVE_TO_END for all) of it from offset with sendfile. Returns 1 on a hit, 0 on a
+//miss, -1 if the client went away during a hit.
+int cacheServe(w24Cache *cache, const w24Reply *reply, const char *key, const char *baseName,
+               unsigned long long offset, unsigned long long length);
+
+//Start storing a miss: tee->fd is an unnamed O_TMPFILE in the cache directory, so an interrupted store
+//leaves nothing behind. Returns -1 if it cannot be created (the archive is then sent uncached).
+int cacheBegin(w24Cache *cache, archiveTee *tee);
+//Link the file in under key if the whole archive made it into the tee, so readers never see a partial entry,
+//and evict least recently used entries past the budget; otherwise drop it.
+void cacheFinish(w24Cache *cache, const char *key, archiveTee *tee);
+
+#endif
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "w24gzip.h"
+
+//Blocks in flight per compression thread: enough that a thread never waits for the writer.
+#define BLOCKS_PER_THREAD 2
+
+//Output room for one compressed block; deflate is given more if this is not enough.
+#define BLOCK_OUT_LEN (GZIP_BLOCK_LEN + GZIP_BLOCK_LEN / 8 + 64)
+
+struct gzipBlock {
+    unsigned char in[GZIP_BLOCK_LEN];
+    size_t inLen;
+    unsigned char dict[GZIP_DICT_LEN]; // Last 32KB of input before this block
+    size_t dictLen;
+    unsigned char *out;
+    size_t outLen;
+    size_t outCap;
+    unsigned long crc;
+    int last;   // Ends the deflate stream
+    int done;   // Compressed and ready to emit
+    int failed;
+};
+
+static int initDeflate(z_stream *strm, int level) {
+    memset(strm, 0, sizeof(*strm));
+    // Raw deflate: the gzip header and trailer are written around the joined blocks
+    return deflateInit2(strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+}
+
+//Deflate one block on its own stream. A sync flush ends every block but the last on a byte boundary, so the
+//pieces can be concatenated; the dictionary lets matches reach back into the previous block as they would
+//in a single-threaded stream.
+static void compressBlock(z_stream *strm, gzipBlock *block) {
+    block->crc = crc32(0L, block->in, block->inLen);
+    block->outLen = 0;
+
+    if (deflateReset(strm) != Z_OK ||
+        (block->dictLen > 0 && deflateSetDictionary(strm, block->dict, block->dictLen) != Z_OK)) {
+        block->failed = 1;
+        return;
+    }
+
+    strm->next_in = block->in;
+    strm->avail_in = block->inLen;
+    while (1) {
+        if (block->outLen == block->outCap) {
+            size_t capacity = block->outCap * 2;
+            unsigned char *out = realloc(block->out, capacity);
+            if (!out) {
+                block->failed = 1;
+                return;
+            }
+            block->out = out;
+            block->outCap = capacity;
+        }
+        strm->next_out = block->out + block->outLen;
+        strm->avail_out = block->outCap - block->outLen;
+
+        int result = deflate(strm, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+        block->outLen = block->outCap - strm->avail_out;
+        if (result == Z_STREAM_ERROR) {
+            block->failed = 1;
+            return;
+        }
+        // Done once deflate stops short of filling the output
+        if (block->last ? result == Z_STREAM_END : strm->avail_out > 0) {
+            return;
+        }
+    }
+}
+
+static void *gzipWorker(void *arg) {
+    gzipStream *stream = arg;
+    z_stream strm;
+    int ready = initDeflate(&strm, stream->level) == 0;
+
+    pthread_mutex_lock(&stream->lock);
+    while (1) {
+        while (!stream->stopping && stream->nextJob == stream->tail) {
+            pthread_cond_wait(&stream->jobReady, &stream->lock);
+        }
+        if (stream->nextJob == stream->tail) {
+            break; // Stopping with nothing left to compress
+        }
+        gzipBlock *block = stream->ring[stream->nextJob++ % stream->ringSize];
+        pthread_mutex_unlock(&stream->lock);
+
+        if (ready) {
+            compressBlock(&strm, block);
+        } else {
+            block->failed = 1;
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        block->done = 1;
+        pthread_cond_broadcast(&stream->blockDone);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    if (ready) {
+        deflateEnd(&strm);
+    }
+    return NULL;
+}
+
+static int emit(gzipStream *stream, const void *data, size_t length) {
+    if (!stream->failed && length > 0 && stream->output(stream->context, data, length) == -1) {
+        stream->failed = 1;
+    }
+    return stream->failed ? -1 : 0;
+}
+
+//Wait for the oldest submitted block, then send it and fold its CRC into the stream's.
+static void emitHead(gzipStream *stream) {
+    gzipBlock *block = stream->ring[stream->head % stream->ringSize];
+    if (stream->numThreads > 1) {
+        pthread_mutex_lock(&stream->lock);
+        while (!block->done) {
+            pthread_cond_wait(&stream->blockDone, &stream->lock);
+        }
+        pthread_mutex_unlock(&stream->lock);
+    }
+
+    if (block->failed) {
+        stream->failed = 1;
+    }
+    stream->crc = crc32_combine(stream->crc, block->crc, block->inLen);
+    stream->length += block->inLen;
+    emit(stream, block->out, block->outLen);
+    stream->head++;
+}
+
+//Hand the block being filled to the compressors and start the next one.
+static void submitBlock(gzipStream *stream, int last) {
+    // The next block's slot must be free before its dictionary is written
+    while (stream->tail + 1 - stream->head >= (unsigned long)stream->ringSize) {
+        emitHead(stream);
+    }
+
+    gzipBlock *block = stream->ring[stream->tail % stream->ringSize];
+    block->last = last;
+    block->done = 0;
+    block->failed = 0;
+    if (!last) {
+        // Blocks before the last are always full, so the dictionary is the tail of this block alone
+        gzipBlock *next = stream->ring[(stream->tail + 1) % stream->ringSize];
+        memcpy(next->dict, block->in + block->inLen - GZIP_DICT_LEN, GZIP_DICT_LEN);
+        next->dictLen = GZIP_DICT_LEN;
+        next->inLen = 0;
+    }
+
+    if (stream->numThreads > 1) {
+        pthread_mutex_lock(&stream->lock);
+        stream->tail++;
+        pthread_cond_signal(&stream->jobReady);
+        pthread_mutex_unlock(&stream->lock);
+    } else {
+        compressBlock(stream->inlineStream, block);
+        block->done = 1;
+        stream->tail++;
+    }
+
+    // Send whatever is already finished without waiting
+    while (stream->head < stream->tail && stream->ring[stream->head % stream->ringSize]->done) {
+        emitHead(stream);
+    }
+}
+
+gzipStream *gzipStreamNew(int numThreads, int level, gzipOutput output, void *context) {
+    gzipStream *stream = calloc(1, sizeof(gzipStream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->level = level < -1 || level > 9 ? Z_DEFAULT_COMPRESSION : level;
+    stream->numThreads = numThreads < 1 ? 1 : numThreads;
+    stream->output = output;
+    stream->context = context;
+    stream->crc = crc32(0L, Z_NULL, 0);
+    stream->ringSize = stream->numThreads * BLOCKS_PER_THREAD + 1;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->jobReady, NULL);
+    pthread_cond_init(&stream->blockDone, NULL);
+
+    stream->ring = calloc(stream->ringSize, sizeof(gzipBlock *));
+    if (!stream->ring) {
+        gzipStreamFree(stream);
+        return NULL;
+    }
+    for (int i = 0; i < stream->ringSize; i++) {
+        gzipBlock *block = malloc(sizeof(gzipBlock));
+        if (!block || !(block->out = malloc(BLOCK_OUT_LEN))) {
+            free(block);
+            gzipStreamFree(stream);
+            return NULL;
+        }
+        block->outCap = BLOCK_OUT_LEN;
+        block->inLen = 0;
+        block->dictLen = 0;
+        block->done = 0;
+        stream->ring[i] = block;
+    }
+
+    if (stream->numThreads == 1) {
+        stream->inlineStream = malloc(sizeof(z_stream));
+        if (!stream->inlineStream || initDeflate(stream->inlineStream, stream->level) == -1) {
+            free(stream->inlineStream);
+            stream->inlineStream = NULL;
+            gzipStreamFree(stream);
+            return NULL;
+        }
+    } else {
+        stream->threads = calloc(stream->numThreads, sizeof(pthread_t));
+        if (!stream->threads) {
+            gzipStreamFree(stream);
+            return NULL;
+        }
+        while (stream->started < stream->numThreads &&
+               pthread_create(&stream->threads[stream->started], NULL, gzipWorker, stream) == 0) {
+            stream->started++;
+        }
+        if (stream->started == 0) {
+            gzipStreamFree(stream);
+            return NULL;
+        }
+    }
+
+    // Magic, deflate, no flags, no mtime, no extra flags, OS unix
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    emit(stream, header, sizeof(header));
+    return stream;
+}
+
+int gzipStreamWrite(gzipStream *stream, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    while (length > 0 && !stream->failed) {
+        gzipBlock *block = stream->ring[stream->tail % stream->ringSize];
+        size_t chunk = GZIP_BLOCK_LEN - block->inLen;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(block->in + block->inLen, bytes, chunk);
+        block->inLen += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (block->inLen == GZIP_BLOCK_LEN) {
+            submitBlock(stream, 0);
+        }
+    }
+    return stream->failed ? -1 : 0;
+}
+
+int gzipStreamFinish(gzipStream *stream) {
+    if (stream->failed) {
+        return -1;
+    }
+    submitBlock(stream, 1);
+    while (stream->head < stream->tail) {
+        emitHead(stream);
+    }
+
+    unsigned char trailer[8];
+    for (int i = 0; i < 4; i++) {
+        trailer[i] = (stream->crc >> (8 * i)) & 0xff;
+        trailer[4 + i] = (stream->length >> (8 * i)) & 0xff;
+    }
+    return emit(stream, trailer, sizeof(trailer));
+}
+
+void gzipStreamFree(gzipStream *stream) {
+    if (!stream) {
+        return;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->stopping = 1;
+    pthread_cond_broadcast(&stream->jobReady);
+    pthread_mutex_unlock(&stream->lock);
+    for (int i = 0; i < stream->started; i++) {
+        pthread_join(stream->threads[i], NULL);
+    }
+    free(stream->threads);
+
+    if (stream->inlineStream) {
+        deflateEnd(stream->inlineStream);
+        free(stream->inlineStream);
+    }
+    for (int i = 0; stream->ring && i < stream->ringSize; i++) {
+        if (stream->ring[i]) {
+            free(stream->ring[i]->out);
+            free(stream->ring[i]);
+        }
+    }
+    free(stream->ring);
+    pthread_cond_destroy(&stream->blockDone);
+    pthread_cond_destroy(&stream->jobReady);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+}
@@ -0,0 +1,51 @@
+//Block-parallel gzip (pigz style): the input is cut into blocks that are deflated on several threads, each
+//primed with the last 32KB of the block before it, and joined into one standard gzip stream.
+#ifndef W24GZIP_H
+#define W24GZIP_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define GZIP_BLOCK_LEN (128 * 1024)
+#define GZIP_DICT_LEN (32 * 1024)
+
+//Where the compressed stream goes, in order. Returns -1 to abort the stream.
+typedef int (*gzipOutput)(void *context, const void *data, size_t length);
+
+typedef struct gzipBlock gzipBlock;
+
+typedef struct gzipStream {
+    int level;
+    int numThreads;       // 1 compresses inline on the caller's thread
+    gzipOutput output;
+    void *context;
+    int failed;
+
+    // Blocks in stream order: [head, tail) are submitted, the one at tail is being filled
+    gzipBlock **ring;
+    int ringSize;
+    unsigned long head;
+    unsigned long tail;
+    unsigned long nextJob; // First submitted block no worker has taken yet
+
+    unsigned long crc;    // Of the input emitted so far
+    unsigned long length; // Input bytes emitted so far (mod 2^32 in the trailer)
+
+    void *inlineStream;   // z_stream used when numThreads is 1
+
+    pthread_t *threads;
+    int started;
+    pthread_mutex_t lock;
+    pthread_cond_t jobReady;  // Workers wait for submitted blocks
+    pthread_cond_t blockDone; // The caller waits for the head block
+    int stopping;
+} gzipStream;
+
+//Start a stream; level is a zlib level (-1 for the default). Returns NULL on failure.
+gzipStream *gzipStreamNew(int numThreads, int level, gzipOutput output, void *context);
+int gzipStreamWrite(gzipStream *stream, const void *data, size_t length);
+//Compress what is left and write the gzip trailer. Returns -1 if the stream failed at any point.
+int gzipStreamFinish(gzipStream *stream);
+void gzipStreamFree(gzipStream *stream);
+
+#endif
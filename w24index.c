@@ -0,0 +1,1368 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "w24index.h"
+
+#define INITIAL_ENTRIES 1024
+#define INITIAL_EXT_SLOTS 64
+
+#define MAX_EXTENSION_LEN 256
+
+//Compact the name pool once removed names take up this much and more than half of it.
+#define MIN_GARBAGE_TO_COMPACT (64 * 1024)
+
+//Changes the watcher applies: anything that can add, remove or alter an entry of the directory.
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MODIFY | \
+                      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define WATCH_BUFFER_LEN (64 * 1024)
+
+typedef struct watchContext {
+    w24Index *index;
+    int fd;
+    char **wdPaths; // Directory watched by each watch descriptor, relative to rootDir ("" for rootDir)
+    int wdCap;
+    int limitHit;   // Warned that inotify ran out of watches
+} watchContext;
+
+//FNV-1a, good enough to spread file names over the open-addressing tables.
+static uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static double nowUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void freeTable(w24IndexTable *t) {
+    free(t->nameOffset);
+    free(t->size);
+    free(t->btime);
+    free(t->mtime);
+    free(t->mode);
+    free(t->type);
+    free(t->depth);
+    free(t->baseNext);
+    free(t->names);
+    free(t->nameSlots);
+    free(t->baseSlots);
+    free(t->bySize);
+    free(t->byBirth);
+    free(t->freeIds);
+    for (int i = 0; i < t->numExts; i++) {
+        free(t->extNames[i]);
+        free(t->postings[i].ids);
+    }
+    free(t->extNames);
+    free(t->postings);
+    free(t->extSlots);
+    memset(t, 0, sizeof(*t));
+}
+
+//Make room for one more entry in every column.
+static int growColumns(w24IndexTable *t) {
+    if (t->count < t->capacity) {
+        return 0;
+    }
+
+    int capacity = t->capacity ? t->capacity * 2 : INITIAL_ENTRIES;
+    void *columns[8];
+    columns[0] = realloc(t->nameOffset, sizeof(uint32_t) * capacity);
+    if (columns[0]) t->nameOffset = columns[0];
+    columns[1] = realloc(t->size, sizeof(int64_t) * capacity);
+    if (columns[1]) t->size = columns[1];
+    columns[2] = realloc(t->btime, sizeof(int64_t) * capacity);
+    if (columns[2]) t->btime = columns[2];
+    columns[3] = realloc(t->mtime, sizeof(int64_t) * capacity);
+    if (columns[3]) t->mtime = columns[3];
+    columns[4] = realloc(t->mode, sizeof(uint32_t) * capacity);
+    if (columns[4]) t->mode = columns[4];
+    columns[5] = realloc(t->type, sizeof(uint8_t) * capacity);
+    if (columns[5]) t->type = columns[5];
+    columns[6] = realloc(t->depth, sizeof(uint16_t) * capacity);
+    if (columns[6]) t->depth = columns[6];
+    columns[7] = realloc(t->baseNext, sizeof(uint32_t) * capacity);
+    if (columns[7]) t->baseNext = columns[7];
+
+    for (int i = 0; i < 8; i++) {
+        if (!columns[i]) {
+            return -1;
+        }
+    }
+    t->capacity = capacity;
+    return 0;
+}
+
+//Copy a name into the pool. Returns its offset, or -1 on allocation failure.
+static long appendName(w24IndexTable *t, const char *name) {
+    size_t length = strlen(name) + 1;
+    if (t->namesLen + length > t->namesCap) {
+        size_t capacity = t->namesCap ? t->namesCap * 2 : INITIAL_ENTRIES * 16;
+        while (capacity < t->namesLen + length) {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX) {
+            return -1; // Offsets are 32-bit
+        }
+        char *names = realloc(t->names, capacity);
+        if (!names) {
+            return -1;
+        }
+        t->names = names;
+        t->namesCap = capacity;
+    }
+
+    long offset = t->namesLen;
+    memcpy(t->names + offset, name, length);
+    t->namesLen += length;
+    return offset;
+}
+
+//Slot of an extension in the extension table: either holding it or the empty slot it belongs in.
+static uint32_t extSlot(const w24IndexTable *t, const char *extension) {
+    uint32_t slot = hashName(extension) & t->extMask;
+    while (t->extSlots[slot] != 0 && strcmp(t->extNames[t->extSlots[slot] - 1], extension) != 0) {
+        slot = (slot + 1) & t->extMask;
+    }
+    return slot;
+}
+
+//Number of an extension, adding it if it is new. Returns -1 on allocation failure.
+static int internExtension(w24IndexTable *t, const char *extension) {
+    if (t->extSlots == NULL || (uint32_t)(t->numExts + 1) * 2 > t->extMask + 1) {
+        // Keep the table at most half full
+        uint32_t slots = t->extSlots ? (t->extMask + 1) * 2 : INITIAL_EXT_SLOTS;
+        uint32_t *extSlots = calloc(slots, sizeof(uint32_t));
+        char **extNames = realloc(t->extNames, sizeof(char *) * slots / 2);
+        if (extNames) {
+            t->extNames = extNames;
+        }
+        indexPostings *postings = realloc(t->postings, sizeof(indexPostings) * slots / 2);
+        if (postings) {
+            t->postings = postings;
+        }
+        if (!extSlots || !extNames || !postings) {
+            free(extSlots);
+            return -1;
+        }
+        free(t->extSlots);
+        t->extSlots = extSlots;
+        t->extMask = slots - 1;
+        t->extCap = slots / 2;
+        for (int i = 0; i < t->numExts; i++) {
+            t->extSlots[extSlot(t, t->extNames[i])] = i + 1;
+        }
+    }
+
+    uint32_t slot = extSlot(t, extension);
+    if (t->extSlots[slot] != 0) {
+        return t->extSlots[slot] - 1;
+    }
+
+    char *copy = strdup(extension);
+    if (!copy) {
+        return -1;
+    }
+    t->extNames[t->numExts] = copy;
+    memset(&t->postings[t->numExts], 0, sizeof(indexPostings));
+    t->extSlots[slot] = ++t->numExts;
+    return t->numExts - 1;
+}
+
+//Number of an extension without adding it; -1 if no file has it.
+static int findExtension(const w24IndexTable *t, const char *extension) {
+    if (t->extSlots == NULL) {
+        return -1;
+    }
+    return (int)t->extSlots[extSlot(t, extension)] - 1;
+}
+
+//Extensions match case-insensitively, so keys are stored and looked up in lower case.
+static void lowercaseKey(char *key, const char *extension) {
+    size_t i = 0;
+    for (; extension[i] != '\0' && i < MAX_EXTENSION_LEN - 1; i++) {
+        key[i] = tolower((unsigned char)extension[i]);
+    }
+    key[i] = '\0';
+}
+
+//Position of the first id in a posting list that is not below id.
+static int postingPosition(const indexPostings *list, uint32_t id) {
+    int low = 0, high = list->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (list->ids[mid] < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+//Last component of a path.
+static const char *baseName(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+//Add a file to the posting list of every suffix of its base name after a dot.
+static int addPostings(w24IndexTable *t, uint32_t id) {
+    const char *name = baseName(t->names + t->nameOffset[id]);
+    for (const char *dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+        char key[MAX_EXTENSION_LEN];
+        lowercaseKey(key, dot + 1);
+        int ext = internExtension(t, key);
+        if (ext == -1) {
+            return -1;
+        }
+
+        indexPostings *list = &t->postings[ext];
+        if (list->count == list->capacity) {
+            int capacity = list->capacity ? list->capacity * 2 : 8;
+            uint32_t *ids = realloc(list->ids, sizeof(uint32_t) * capacity);
+            if (!ids) {
+                return -1;
+            }
+            list->ids = ids;
+            list->capacity = capacity;
+        }
+        // Scans add ids in ascending order, so this is almost always an append
+        int pos = postingPosition(list, id);
+        memmove(list->ids + pos + 1, list->ids + pos, sizeof(uint32_t) * (list->count - pos));
+        list->ids[pos] = id;
+        list->count++;
+    }
+    return 0;
+}
+
+static void removePostings(w24IndexTable *t, uint32_t id) {
+    const char *name = baseName(t->names + t->nameOffset[id]);
+    for (const char *dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+        char key[MAX_EXTENSION_LEN];
+        lowercaseKey(key, dot + 1);
+        int ext = findExtension(t, key);
+        if (ext == -1) {
+            continue;
+        }
+
+        indexPostings *list = &t->postings[ext];
+        int pos = postingPosition(list, id);
+        if (pos < list->count && list->ids[pos] == id) {
+            memmove(list->ids + pos, list->ids + pos + 1, sizeof(uint32_t) * (list->count - pos - 1));
+            list->count--;
+        }
+    }
+}
+
+//Slot of a name in the name table: either holding it or the empty slot it belongs in.
+static uint32_t nameSlot(const w24IndexTable *t, const char *name) {
+    uint32_t slot = hashName(name) & t->nameMask;
+    while (t->nameSlots[slot] != 0 && strcmp(t->names + t->nameOffset[t->nameSlots[slot] - 1], name) != 0) {
+        slot = (slot + 1) & t->nameMask;
+    }
+    return slot;
+}
+
+//Slot of a base name in the base name table, which shares the name table's size.
+static uint32_t baseSlot(const w24IndexTable *t, const char *name) {
+    uint32_t slot = hashName(name) & t->nameMask;
+    while (t->baseSlots[slot] != 0 &&
+           strcmp(baseName(t->names + t->nameOffset[t->baseSlots[slot] - 1]), name) != 0) {
+        slot = (slot + 1) & t->nameMask;
+    }
+    return slot;
+}
+
+//Entry id of a name, or -1.
+static int findName(const w24IndexTable *t, const char *name) {
+    if (t->nameSlots == NULL) {
+        return -1;
+    }
+    return (int)t->nameSlots[nameSlot(t, name)] - 1;
+}
+
+//Put an entry at the head of the chain of entries with its base name.
+static void linkBaseName(w24IndexTable *t, uint32_t id) {
+    uint32_t slot = baseSlot(t, baseName(t->names + t->nameOffset[id]));
+    t->baseNext[id] = t->baseSlots[slot];
+    t->baseSlots[slot] = id + 1;
+}
+
+//Rebuild the name and base name tables with room for at least twice the live entries.
+static int resizeNameTable(w24IndexTable *t, int entries) {
+    uint32_t slots = 16;
+    while (slots < (uint32_t)entries * 2) {
+        slots *= 2;
+    }
+
+    uint32_t *nameSlots = calloc(slots, sizeof(uint32_t));
+    uint32_t *baseSlots = calloc(slots, sizeof(uint32_t));
+    if (!nameSlots || !baseSlots) {
+        free(nameSlots);
+        free(baseSlots);
+        return -1;
+    }
+    free(t->nameSlots);
+    free(t->baseSlots);
+    t->nameSlots = nameSlots;
+    t->baseSlots = baseSlots;
+    t->nameMask = slots - 1;
+
+    // Walking ids downwards leaves every chain in ascending id order
+    for (int id = t->count - 1; id >= 0; id--) {
+        if (t->type[id] != INDEX_TYPE_FREE) {
+            t->nameSlots[nameSlot(t, t->names + t->nameOffset[id])] = id + 1;
+            linkBaseName(t, id);
+        }
+    }
+    return 0;
+}
+
+//Empty a slot of an open-addressing table keyed by keyOf, shifting later members of its probe run back
+//into the hole.
+static void clearSlot(w24IndexTable *t, uint32_t *slots, uint32_t hole,
+                      const char *(*keyOf)(const w24IndexTable *, uint32_t)) {
+    slots[hole] = 0;
+
+    uint32_t slot = (hole + 1) & t->nameMask;
+    while (slots[slot] != 0) {
+        uint32_t home = hashName(keyOf(t, slots[slot] - 1)) & t->nameMask;
+        // Move the entry back if the hole lies between its home slot and where it sits now
+        if (((slot - home) & t->nameMask) >= ((slot - hole) & t->nameMask)) {
+            slots[hole] = slots[slot];
+            slots[slot] = 0;
+            hole = slot;
+        }
+        slot = (slot + 1) & t->nameMask;
+    }
+}
+
+static const char *entryName(const w24IndexTable *t, uint32_t id) {
+    return t->names + t->nameOffset[id];
+}
+
+static const char *entryBaseName(const w24IndexTable *t, uint32_t id) {
+    return baseName(t->names + t->nameOffset[id]);
+}
+
+//Remove a name from the name table.
+static void deleteName(w24IndexTable *t, const char *name) {
+    uint32_t hole = nameSlot(t, name);
+    if (t->nameSlots[hole] != 0) {
+        clearSlot(t, t->nameSlots, hole, entryName);
+    }
+}
+
+//Take an entry out of the chain of its base name, dropping the chain once it is empty.
+static void unlinkBaseName(w24IndexTable *t, uint32_t id) {
+    uint32_t slot = baseSlot(t, entryBaseName(t, id));
+    uint32_t *link = &t->baseSlots[slot];
+    while (*link != 0 && *link != id + 1) {
+        link = &t->baseNext[*link - 1];
+    }
+    if (*link == 0) {
+        return;
+    }
+    *link = t->baseNext[id];
+    if (t->baseSlots[slot] == 0) {
+        clearSlot(t, t->baseSlots, slot, entryBaseName);
+    }
+}
+
+//Position of the first id in order whose (column value, id) is not below (value, id).
+static int lowerBound(const w24IndexTable *t, const uint32_t *order, const int64_t *column, int64_t value, uint32_t id) {
+    int low = 0, high = t->numFiles;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        uint32_t midId = order[mid];
+        if (column[midId] < value || (column[midId] == value && midId < id)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+//Add a file to both orders; the caller has already stored its attributes.
+static int insertSorted(w24IndexTable *t, uint32_t id) {
+    if (t->numFiles == t->sortedCap) {
+        int capacity = t->sortedCap ? t->sortedCap * 2 : INITIAL_ENTRIES;
+        uint32_t *bySize = realloc(t->bySize, sizeof(uint32_t) * capacity);
+        if (bySize) {
+            t->bySize = bySize;
+        }
+        uint32_t *byBirth = realloc(t->byBirth, sizeof(uint32_t) * capacity);
+        if (byBirth) {
+            t->byBirth = byBirth;
+        }
+        if (!bySize || !byBirth) {
+            return -1;
+        }
+        t->sortedCap = capacity;
+    }
+
+    uint32_t *orders[2] = { t->bySize, t->byBirth };
+    const int64_t *columns[2] = { t->size, t->btime };
+    for (int i = 0; i < 2; i++) {
+        int pos = lowerBound(t, orders[i], columns[i], columns[i][id], id);
+        memmove(orders[i] + pos + 1, orders[i] + pos, sizeof(uint32_t) * (t->numFiles - pos));
+        orders[i][pos] = id;
+    }
+    t->numFiles++;
+    return 0;
+}
+
+//Take a file out of both orders; must run before its size or btime changes.
+static void removeSorted(w24IndexTable *t, uint32_t id) {
+    uint32_t *orders[2] = { t->bySize, t->byBirth };
+    const int64_t *columns[2] = { t->size, t->btime };
+    for (int i = 0; i < 2; i++) {
+        int pos = lowerBound(t, orders[i], columns[i], columns[i][id], id);
+        memmove(orders[i] + pos, orders[i] + pos + 1, sizeof(uint32_t) * (t->numFiles - pos - 1));
+    }
+    t->numFiles--;
+}
+
+static int compareBySize(const void *a, const void *b, void *arg) {
+    const w24IndexTable *t = arg;
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    if (t->size[x] != t->size[y]) {
+        return t->size[x] < t->size[y] ? -1 : 1;
+    }
+    return (x > y) - (x < y);
+}
+
+static int compareByBirth(const void *a, const void *b, void *arg) {
+    const w24IndexTable *t = arg;
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    if (t->btime[x] != t->btime[y]) {
+        return t->btime[x] < t->btime[y] ? -1 : 1;
+    }
+    return (x > y) - (x < y);
+}
+
+//Sort all files at once after a full scan.
+static int buildSorted(w24IndexTable *t) {
+    int capacity = t->capacity ? t->capacity : INITIAL_ENTRIES;
+    t->bySize = malloc(sizeof(uint32_t) * capacity);
+    t->byBirth = malloc(sizeof(uint32_t) * capacity);
+    if (!t->bySize || !t->byBirth) {
+        return -1;
+    }
+    t->sortedCap = capacity;
+
+    t->numFiles = 0;
+    for (int id = 0; id < t->count; id++) {
+        if (t->type[id] == INDEX_TYPE_FILE) {
+            t->bySize[t->numFiles] = id;
+            t->byBirth[t->numFiles] = id;
+            t->numFiles++;
+        }
+    }
+    qsort_r(t->bySize, t->numFiles, sizeof(uint32_t), compareBySize, t);
+    qsort_r(t->byBirth, t->numFiles, sizeof(uint32_t), compareByBirth, t);
+    return 0;
+}
+
+static void setAttributes(w24IndexTable *t, int id, const walkEntry *entry) {
+    t->size[id] = entry->size;
+    t->btime[id] = entry->btime;
+    t->mtime[id] = entry->mtime;
+    t->mode[id] = entry->mode;
+    t->type[id] = entry->type;
+}
+
+//Store a new entry, reusing the id of a removed one when possible. The name table is not touched.
+static int storeEntry(w24IndexTable *t, const char *name, const walkEntry *entry) {
+    long offset = appendName(t, name);
+    if (offset == -1) {
+        return -1;
+    }
+
+    int id;
+    if (t->numFree > 0) {
+        id = t->freeIds[--t->numFree];
+    } else {
+        if (growColumns(t) == -1) {
+            return -1;
+        }
+        id = t->count++;
+    }
+
+    t->nameOffset[id] = offset;
+    setAttributes(t, id, entry);
+    int depth = 0;
+    for (const char *c = name; *c; c++) {
+        depth += *c == '/';
+    }
+    t->depth[id] = depth < UINT16_MAX ? depth : UINT16_MAX;
+    t->live++;
+    if (entry->type == INDEX_TYPE_FILE && addPostings(t, id) == -1) {
+        return -1;
+    }
+    return id;
+}
+
+//Add an entry found after the initial scan.
+static int addEntry(w24IndexTable *t, const char *name, const walkEntry *entry) {
+    if ((uint32_t)(t->live + 1) * 2 > t->nameMask + 1 && resizeNameTable(t, t->live + 1) == -1) {
+        return -1;
+    }
+
+    int id = storeEntry(t, name, entry);
+    if (id == -1) {
+        return -1;
+    }
+    t->nameSlots[nameSlot(t, name)] = id + 1;
+    linkBaseName(t, id);
+    if (entry->type == INDEX_TYPE_DIR) {
+        t->dirChanges++;
+    }
+    return entry->type == INDEX_TYPE_FILE ? insertSorted(t, id) : 0;
+}
+
+//New attributes for an existing entry, keeping the range orders in step.
+static int changeEntry(w24IndexTable *t, int id, const walkEntry *entry) {
+    if ((t->type[id] == INDEX_TYPE_DIR) != (entry->type == INDEX_TYPE_DIR) ||
+        (entry->type == INDEX_TYPE_DIR && t->btime[id] != entry->btime)) {
+        t->dirChanges++;
+    }
+    if (t->type[id] == INDEX_TYPE_FILE && entry->type == INDEX_TYPE_FILE && t->size[id] == entry->size &&
+        t->btime[id] == entry->btime) {
+        setAttributes(t, id, entry); // Same place in both orders
+        return 0;
+    }
+    if (t->type[id] == INDEX_TYPE_FILE) {
+        removeSorted(t, id);
+        if (entry->type != INDEX_TYPE_FILE) {
+            removePostings(t, id);
+        }
+    } else if (entry->type == INDEX_TYPE_FILE && addPostings(t, id) == -1) {
+        return -1;
+    }
+    setAttributes(t, id, entry);
+    return entry->type == INDEX_TYPE_FILE ? insertSorted(t, id) : 0;
+}
+
+static int removeEntry(w24IndexTable *t, int id) {
+    if (t->type[id] == INDEX_TYPE_FILE) {
+        removeSorted(t, id);
+        removePostings(t, id);
+    } else if (t->type[id] == INDEX_TYPE_DIR) {
+        t->dirChanges++;
+    }
+
+    const char *name = t->names + t->nameOffset[id];
+    deleteName(t, name);
+    unlinkBaseName(t, id);
+    t->namesGarbage += strlen(name) + 1;
+
+    if (t->numFree == t->freeCap) {
+        int capacity = t->freeCap ? t->freeCap * 2 : 64;
+        uint32_t *freeIds = realloc(t->freeIds, sizeof(uint32_t) * capacity);
+        if (!freeIds) {
+            return -1;
+        }
+        t->freeIds = freeIds;
+        t->freeCap = capacity;
+    }
+    t->freeIds[t->numFree++] = id;
+
+    t->type[id] = INDEX_TYPE_FREE;
+    t->live--;
+    return 0;
+}
+
+//Drop the names of removed entries from the pool.
+static int compactNames(w24IndexTable *t) {
+    size_t capacity = t->namesLen - t->namesGarbage + 1;
+    char *names = malloc(capacity);
+    if (!names) {
+        return -1;
+    }
+
+    size_t length = 0;
+    for (int id = 0; id < t->count; id++) {
+        if (t->type[id] != INDEX_TYPE_FREE) {
+            size_t nameLength = strlen(t->names + t->nameOffset[id]) + 1;
+            memcpy(names + length, t->names + t->nameOffset[id], nameLength);
+            t->nameOffset[id] = length;
+            length += nameLength;
+        }
+    }
+
+    free(t->names);
+    t->names = names;
+    t->namesLen = length;
+    t->namesCap = capacity;
+    t->namesGarbage = 0;
+    return 0;
+}
+
+//Walk the tree into an empty table. Entries that cannot be stat'ed are left out, as the per-request
+//scans did.
+static int scanTree(const char *rootDir, int walkThreads, w24IndexTable *t) {
+    walkResult *results;
+    int numResults = walkTree(rootDir, "", walkThreads, &results);
+    if (numResults == -1) {
+        return -1;
+    }
+
+    for (int r = 0; r < numResults; r++) {
+        for (int i = 0; i < results[r].count; i++) {
+            const walkEntry *entry = &results[r].entries[i];
+            if (storeEntry(t, results[r].paths + entry->pathOffset, entry) == -1) {
+                walkResultsFree(results, numResults);
+                return -1;
+            }
+        }
+    }
+    walkResultsFree(results, numResults);
+
+    // Hash and sort everything in one go now that the entries are known
+    if (resizeNameTable(t, t->live) == -1) {
+        return -1;
+    }
+    return buildSorted(t);
+}
+
+int indexInit(w24Index *index, const char *rootDir, int walkThreads) {
+    memset(index, 0, sizeof(*index));
+    snprintf(index->rootDir, sizeof(index->rootDir), "%s", rootDir);
+    index->walkThreads = walkThreads > 0 ? walkThreads : sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_rwlock_init(&index->lock, NULL);
+    pthread_mutex_init(&index->dirOrderLock, NULL);
+    index->table.dirChanges = 1;
+
+    if (scanTree(index->rootDir, index->walkThreads, &index->table) == -1) {
+        indexFree(index);
+        return -1;
+    }
+    index->generation = 1;
+    return 0;
+}
+
+void indexFree(w24Index *index) {
+    freeTable(&index->table);
+    for (int i = 0; i < 4; i++) {
+        free(index->dirOrders[i].ids);
+    }
+    pthread_rwlock_destroy(&index->lock);
+    pthread_mutex_destroy(&index->dirOrderLock);
+}
+
+int indexRescan(w24Index *index) {
+    w24IndexTable fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    if (scanTree(index->rootDir, index->walkThreads, &fresh) == -1) {
+        freeTable(&fresh);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+    w24IndexTable old = index->table;
+    fresh.dirChanges = old.dirChanges + 1;
+    index->table = fresh;
+    index->generation++;
+    pthread_rwlock_unlock(&index->lock);
+
+    freeTable(&old);
+    return 0;
+}
+
+//Bring the entry for one path in line with what is on disk; entry is NULL if the path is gone. Runs
+//under the write lock.
+static int applyEntry(w24IndexTable *t, const char *path, const walkEntry *entry) {
+    int id = findName(t, path);
+    if (entry && id != -1) {
+        return changeEntry(t, id, entry);
+    } else if (entry) {
+        return addEntry(t, path, entry);
+    } else if (id != -1) {
+        int result = removeEntry(t, id);
+        if (t->namesGarbage > MIN_GARBAGE_TO_COMPACT && t->namesGarbage * 2 > t->namesLen) {
+            compactNames(t);
+        }
+        return result;
+    }
+    return 0;
+}
+
+int indexUpdate(w24Index *index, const char *path) {
+    char fullPath[sizeof(index->rootDir) + PATH_MAX];
+    snprintf(fullPath, sizeof(fullPath), "%s/%s", index->rootDir, path);
+
+    // Stat before taking the lock so queries only wait for the column writes
+    walkEntry entry;
+    int exists = walkStatEntry(AT_FDCWD, fullPath, DT_UNKNOWN, &entry) == 0;
+
+    pthread_rwlock_wrlock(&index->lock);
+    int result = applyEntry(&index->table, path, exists ? &entry : NULL);
+    index->generation++;
+    pthread_rwlock_unlock(&index->lock);
+
+    return result;
+}
+
+//Shallowest entry with this base name, ties going to the smaller path; -1 if there is none. Walks only the
+//chain of entries with that base name.
+static int findBaseName(const w24IndexTable *t, const char *name) {
+    if (t->baseSlots == NULL) {
+        return -1;
+    }
+    int best = -1;
+    for (uint32_t link = t->baseSlots[baseSlot(t, name)]; link != 0; link = t->baseNext[link - 1]) {
+        int id = link - 1;
+        const char *path = t->names + t->nameOffset[id];
+        if (best == -1 || t->depth[id] < t->depth[best] ||
+            (t->depth[id] == t->depth[best] && strcmp(path, t->names + t->nameOffset[best]) < 0)) {
+            best = id;
+        }
+    }
+    return best;
+}
+
+//Count the entries a query examined into the caller's counter, if it keeps one. Queries run side by side.
+static void countScanned(w24Index *index, size_t entries) {
+    if (index->scanned) {
+        __atomic_fetch_add(index->scanned, entries, __ATOMIC_RELAXED);
+    }
+}
+
+int indexLookup(w24Index *index, const char *name, int recursive, w24IndexEntry *out) {
+    pthread_rwlock_rdlock(&index->lock);
+    const w24IndexTable *t = &index->table;
+    int id = recursive ? findBaseName(t, name) : strchr(name, '/') ? -1 : findName(t, name);
+    if (id != -1) {
+        snprintf(out->path, sizeof(out->path), "%s", t->names + t->nameOffset[id]);
+        out->size = t->size[id];
+        out->btime = t->btime[id];
+        out->mtime = t->mtime[id];
+        out->mode = t->mode[id];
+        out->type = t->type[id];
+    }
+    pthread_rwlock_unlock(&index->lock);
+    countScanned(index, 1);
+
+    return id != -1;
+}
+
+static int compareDirNames(const void *a, const void *b, void *arg) {
+    const w24IndexTable *t = arg;
+    return strcmp(t->names + t->nameOffset[*(const uint32_t *)a], t->names + t->nameOffset[*(const uint32_t *)b]);
+}
+
+//Birth times are cached in the index, so sorting makes no system calls; ties go by name.
+static int compareDirBirthTime(const void *a, const void *b, void *arg) {
+    const w24IndexTable *t = arg;
+    int64_t x = t->btime[*(const uint32_t *)a], y = t->btime[*(const uint32_t *)b];
+    return x != y ? (x > y) - (x < y) : compareDirNames(a, b, arg);
+}
+
+//Bring one dirlist order up to date with the table. Runs under the read lock and dirOrderLock.
+static int refreshDirOrder(const w24IndexTable *t, indexDirOrder *order, int byCreationTime, int recursive) {
+    if (order->ids != NULL && order->dirChanges == t->dirChanges) {
+        return 0;
+    }
+
+    uint32_t *ids = realloc(order->ids, sizeof(uint32_t) * (t->count ? t->count : 1));
+    if (!ids) {
+        return -1;
+    }
+    order->ids = ids;
+    order->count = 0;
+    for (int id = 0; id < t->count; id++) {
+        if (t->type[id] == INDEX_TYPE_DIR && (recursive || t->depth[id] == 0)) {
+            order->ids[order->count++] = id;
+        }
+    }
+    qsort_r(order->ids, order->count, sizeof(uint32_t), byCreationTime ? compareDirBirthTime : compareDirNames,
+            (void *)t);
+    order->dirChanges = t->dirChanges;
+    return 0;
+}
+
+int indexDirectories(w24Index *index, int byCreationTime, int recursive, size_t offset, size_t limit, w24Buffer *out) {
+    pthread_rwlock_rdlock(&index->lock);
+    pthread_mutex_lock(&index->dirOrderLock);
+    const w24IndexTable *t = &index->table;
+    indexDirOrder *order = &index->dirOrders[byCreationTime * 2 + recursive];
+
+    int listed = refreshDirOrder(t, order, byCreationTime, recursive);
+    // The names go straight from the index's name pool into the reply, one line each
+    for (size_t i = offset; listed != -1 && i < (size_t)order->count && i - offset < limit; i++) {
+        const char *name = t->names + t->nameOffset[order->ids[i]];
+        if (bufferAppend(out, name, strlen(name)) == -1 || bufferAppend(out, "\n", 1) == -1) {
+            listed = -1;
+        } else {
+            listed++;
+        }
+    }
+    pthread_mutex_unlock(&index->dirOrderLock);
+    pthread_rwlock_unlock(&index->lock);
+    return listed;
+}
+
+//Add the files at positions [first, last) of an order to the list; only top-level ones unless recursive.
+static void addRange(const w24IndexTable *t, const uint32_t *order, int first, int last, int recursive,
+                     archiveList *out) {
+    for (int i = first; i < last; i++) {
+        if (recursive || t->depth[order[i]] == 0) {
+            archiveListAdd(out, t->names + t->nameOffset[order[i]]);
+        }
+    }
+}
+
+int indexSelectSizeRange(w24Index *index, long long minSize, long long maxSize, int recursive, archiveList *out) {
+    pthread_rwlock_rdlock(&index->lock);
+    const w24IndexTable *t = &index->table;
+    if (minSize <= maxSize) {
+        int first = lowerBound(t, t->bySize, t->size, minSize, 0);
+        int last = lowerBound(t, t->bySize, t->size, maxSize, UINT32_MAX);
+        addRange(t, t->bySize, first, last, recursive, out);
+        countScanned(index, last - first);
+    }
+    pthread_rwlock_unlock(&index->lock);
+    return out->count;
+}
+
+static int compareIds(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int indexSelectExtensions(w24Index *index, const char **extensions, int numExtensions, int recursive,
+                          archiveList *out) {
+    pthread_rwlock_rdlock(&index->lock);
+    const w24IndexTable *t = &index->table;
+
+    // Union of the posting lists; a file listed under two requested suffixes (tar.gz and gz) is added once
+    size_t total = 0;
+    int lists[numExtensions > 0 ? numExtensions : 1];
+    for (int i = 0; i < numExtensions; i++) {
+        char key[MAX_EXTENSION_LEN];
+        lowercaseKey(key, extensions[i][0] == '.' ? extensions[i] + 1 : extensions[i]);
+        lists[i] = findExtension(t, key);
+        for (int j = 0; j < i && lists[i] != -1; j++) {
+            if (lists[j] == lists[i]) {
+                lists[i] = -1; // Same extension asked for twice
+            }
+        }
+        if (lists[i] != -1) {
+            total += t->postings[lists[i]].count;
+        }
+    }
+
+    uint32_t *ids = malloc(sizeof(uint32_t) * (total ? total : 1));
+    if (!ids) {
+        pthread_rwlock_unlock(&index->lock);
+        return -1;
+    }
+    size_t numIds = 0;
+    for (int i = 0; i < numExtensions; i++) {
+        if (lists[i] != -1) {
+            memcpy(ids + numIds, t->postings[lists[i]].ids, sizeof(uint32_t) * t->postings[lists[i]].count);
+            numIds += t->postings[lists[i]].count;
+        }
+    }
+    if (numExtensions > 1) {
+        qsort(ids, numIds, sizeof(uint32_t), compareIds);
+    }
+
+    for (size_t i = 0; i < numIds; i++) {
+        if ((i == 0 || ids[i] != ids[i - 1]) && (recursive || t->depth[ids[i]] == 0)) {
+            archiveListAdd(out, t->names + t->nameOffset[ids[i]]);
+        }
+    }
+    pthread_rwlock_unlock(&index->lock);
+    countScanned(index, numIds);
+
+    free(ids);
+    return out->count;
+}
+
+int indexSelectCreationTime(w24Index *index, time_t targetDate, int beforeOrEqual, int recursive, archiveList *out) {
+    pthread_rwlock_rdlock(&index->lock);
+    const w24IndexTable *t = &index->table;
+    int first = beforeOrEqual ? 0 : lowerBound(t, t->byBirth, t->btime, targetDate, 0);
+    int last = beforeOrEqual ? lowerBound(t, t->byBirth, t->btime, targetDate, UINT32_MAX) : t->numFiles;
+    addRange(t, t->byBirth, first, last, recursive, out);
+    pthread_rwlock_unlock(&index->lock);
+    countScanned(index, last - first);
+    return out->count;
+}
+
+size_t indexMemoryUsage(w24Index *index) {
+    pthread_rwlock_rdlock(&index->lock);
+    const w24IndexTable *t = &index->table;
+    size_t perEntry = sizeof(uint32_t) + sizeof(int64_t) * 3 + sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t) +
+                      sizeof(uint32_t);
+    size_t bytes = perEntry * t->capacity + t->namesCap + sizeof(uint32_t) * 2 * (t->nameMask + 1) +
+                   sizeof(uint32_t) * t->freeCap + sizeof(uint32_t) * 2 * t->sortedCap;
+    if (t->extSlots) {
+        bytes += sizeof(uint32_t) * (t->extMask + 1) + (sizeof(char *) + sizeof(indexPostings)) * t->extCap;
+        for (int i = 0; i < t->numExts; i++) {
+            bytes += strlen(t->extNames[i]) + 1 + sizeof(uint32_t) * t->postings[i].capacity;
+        }
+    }
+    pthread_rwlock_unlock(&index->lock);
+    return bytes;
+}
+
+static void freeWatchContext(watchContext *context) {
+    close(context->fd);
+    for (int i = 0; i < context->wdCap; i++) {
+        free(context->wdPaths[i]);
+    }
+    free(context->wdPaths);
+    free(context);
+}
+
+//Watch one directory of the tree and remember which path its watch descriptor stands for. Adding a watch
+//for an inode that already has one returns the same descriptor, so this also renames moved directories.
+static void watchDirectory(watchContext *context, const char *path) {
+    char fullPath[sizeof(context->index->rootDir) + PATH_MAX];
+    snprintf(fullPath, sizeof(fullPath), "%s%s%s", context->index->rootDir, path[0] ? "/" : "", path);
+
+    int wd = inotify_add_watch(context->fd, fullPath, WATCH_EVENTS);
+    if (wd == -1) {
+        if (errno == ENOSPC && !context->limitHit) {
+            fprintf(stderr, "Index watcher: out of inotify watches (fs.inotify.max_user_watches); changes below "
+                            "some directories will only be seen by the next rescan\n");
+            context->limitHit = 1;
+        }
+        return;
+    }
+
+    if (wd >= context->wdCap) {
+        int capacity = context->wdCap ? context->wdCap : 64;
+        while (capacity <= wd) {
+            capacity *= 2;
+        }
+        char **wdPaths = realloc(context->wdPaths, sizeof(char *) * capacity);
+        if (!wdPaths) {
+            return;
+        }
+        memset(wdPaths + context->wdCap, 0, sizeof(char *) * (capacity - context->wdCap));
+        context->wdPaths = wdPaths;
+        context->wdCap = capacity;
+    }
+    free(context->wdPaths[wd]);
+    context->wdPaths[wd] = strdup(path);
+}
+
+//Watch rootDir and every directory the index holds.
+static void watchAllDirectories(watchContext *context) {
+    watchDirectory(context, "");
+
+    // Copy the paths out first; adding watches must not hold up the queries
+    w24Buffer dirs;
+    bufferInit(&dirs);
+    pthread_rwlock_rdlock(&context->index->lock);
+    const w24IndexTable *t = &context->index->table;
+    for (int id = 0; id < t->count; id++) {
+        if (t->type[id] == INDEX_TYPE_DIR) {
+            const char *path = t->names + t->nameOffset[id];
+            bufferAppend(&dirs, path, strlen(path) + 1);
+        }
+    }
+    pthread_rwlock_unlock(&context->index->lock);
+
+    for (size_t pos = 0; pos < dirs.length; pos += strlen(dirs.data + pos) + 1) {
+        watchDirectory(context, dirs.data + pos);
+    }
+    bufferFree(&dirs);
+}
+
+//A directory appeared: walk it into the index and watch it and everything below it. Entries created
+//before its watch was in place are picked up by the walk, later ones by the watch.
+static void addSubtree(watchContext *context, const char *path) {
+    w24Index *index = context->index;
+    watchDirectory(context, path);
+
+    walkResult *results;
+    int numResults = walkTree(index->rootDir, path, 1, &results);
+    if (numResults == -1) {
+        return; // Already gone again
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+    for (int r = 0; r < numResults; r++) {
+        for (int i = 0; i < results[r].count; i++) {
+            const walkEntry *entry = &results[r].entries[i];
+            applyEntry(&index->table, results[r].paths + entry->pathOffset, entry);
+        }
+    }
+    index->generation++;
+    pthread_rwlock_unlock(&index->lock);
+
+    for (int r = 0; r < numResults; r++) {
+        for (int i = 0; i < results[r].count; i++) {
+            if (results[r].entries[i].type == INDEX_TYPE_DIR) {
+                watchDirectory(context, results[r].paths + results[r].entries[i].pathOffset);
+            }
+        }
+    }
+    walkResultsFree(results, numResults);
+}
+
+//Watcher thread: apply every change event to the index. Rescans run here too, so events that arrive
+//during the scan wait in the kernel queue and are applied on top of the new table.
+static void *watchThread(void *arg) {
+    watchContext *context = arg;
+    w24Index *index = context->index;
+    char buffer[WATCH_BUFFER_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t length = read(context->fd, buffer, sizeof(buffer));
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            perror("Index watcher read failed");
+            break;
+        }
+
+        int overflow = 0, moved = 0;
+        const struct inotify_event *previous = NULL;
+        for (char *ptr = buffer; ptr < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            const char *dirPath = event->wd >= 0 && event->wd < context->wdCap ? context->wdPaths[event->wd] : NULL;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = 1;
+            } else if (dirPath == NULL) {
+                continue; // Directory no longer watched
+            } else if (event->mask & IN_IGNORED) {
+                free(context->wdPaths[event->wd]);
+                context->wdPaths[event->wd] = NULL;
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                if (dirPath[0] == '\0') {
+                    fprintf(stderr, "Index watcher: %s was removed or moved\n", index->rootDir);
+                }
+            } else if (event->len > 0) {
+                char path[PATH_MAX];
+                snprintf(path, sizeof(path), "%s%s%s", dirPath, dirPath[0] ? "/" : "", event->name);
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_MOVED_FROM | IN_MOVED_TO))) {
+                    moved = 1; // Every path below it changes
+                } else if ((event->mask & IN_ISDIR) && (event->mask & IN_CREATE)) {
+                    indexUpdate(index, path);
+                    addSubtree(context, path);
+                } else if (previous == NULL || previous->wd != event->wd || strcmp(previous->name, event->name) != 0) {
+                    // The entry is re-stat'ed when applied, so back-to-back events for one name need one update
+                    indexUpdate(index, path);
+                }
+                previous = event;
+            }
+        }
+
+        if (overflow || moved) {
+            if (overflow) {
+                printf("Index watcher: event queue overflowed, rescanning %s\n", index->rootDir);
+            }
+            indexRescan(index);
+            watchAllDirectories(context);
+        }
+    }
+
+    freeWatchContext(context);
+    return NULL;
+}
+
+int indexWatch(w24Index *index) {
+    watchContext *context = calloc(1, sizeof(watchContext));
+    if (!context) {
+        return -1;
+    }
+    context->index = index;
+    context->fd = inotify_init1(IN_CLOEXEC);
+    if (context->fd == -1 || inotify_add_watch(context->fd, index->rootDir, WATCH_EVENTS) == -1) {
+        perror("Failed to watch the indexed directory");
+        if (context->fd != -1) {
+            close(context->fd);
+        }
+        free(context);
+        return -1;
+    }
+
+    // Every directory of the initial scan gets its watch, then anything that changed in between is rescanned.
+    // Directories created after their parent's watch arrive as events.
+    watchAllDirectories(context);
+    if (indexRescan(index) == -1) {
+        freeWatchContext(context);
+        return -1;
+    }
+    watchAllDirectories(context);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, watchThread, context) != 0) {
+        freeWatchContext(context);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+//One directory of scanWithStat, recursing into subdirectories.
+static void scanDirectoryWithStat(const char *dirPath, int *entries, unsigned long *syscalls) {
+    DIR *dir = opendir(dirPath);
+    *syscalls += 3; // openat, fstat and close
+    if (!dir) {
+        return;
+    }
+
+    size_t recordBytes = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        recordBytes += entry->d_reclen;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+        struct stat st;
+        (*syscalls)++;
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        (*entries)++;
+        if (entry->d_type == DT_DIR) {
+            scanDirectoryWithStat(path, entries, syscalls);
+        }
+    }
+    closedir(dir);
+
+    // readdir refills a 32KB buffer with getdents64, plus the call that finds the end
+    *syscalls += recordBytes / (32 * 1024) + 2;
+}
+
+//The loop the walker replaced, and the work a recursive request would do without the index: readdir,
+//then stat() on a freshly built absolute path for every entry, one directory at a time. Returns the
+//entries found and adds the system calls made to *syscalls (readdir's are inferred from record sizes).
+static int scanWithStat(const char *rootDir, unsigned long *syscalls) {
+    int entries = 0;
+    scanDirectoryWithStat(rootDir, &entries, syscalls);
+    return entries;
+}
+
+void indexBenchmark(const char *rootDir) {
+    w24Index index;
+
+    double start = nowUs();
+    if (indexInit(&index, rootDir, 0) == -1) {
+        return;
+    }
+    double buildMs = (nowUs() - start) / 1000.0;
+
+    const w24IndexTable *t = &index.table;
+    size_t bytes = indexMemoryUsage(&index);
+    printf("Index of %s: %d entries, %d extensions\n", rootDir, t->live, t->numExts);
+    printf("Build (%d threads): %.1f ms, memory: %zu bytes (%.1f bytes/entry)\n", index.walkThreads, buildMs, bytes,
+           t->live ? (double)bytes / t->live : 0.0);
+
+    unsigned long syscalls = 0;
+    start = nowUs();
+    scanWithStat(rootDir, &syscalls);
+    double scanUs = nowUs() - start;
+    printf("%-28s %12.1f us/query\n", "readdir+stat scan (before)", scanUs);
+
+    // Lookups cycle through every top-level name; the filters run over the whole tree (-r) and repeat
+    // until they have run for a while
+    int iterations = 0;
+    w24IndexEntry found;
+    start = nowUs();
+    for (int i = 0; i < t->count; i++) {
+        if (t->depth[i] == 0) {
+            indexLookup(&index, t->names + t->nameOffset[i], 0, &found);
+            iterations++;
+        }
+    }
+    if (iterations > 0) {
+        printf("%-28s %12.3f us/query\n", "w24fn lookup", (nowUs() - start) / iterations);
+    }
+
+    const char *extensions[] = { "txt", "pdf", "c" };
+    time_t weekAgo = time(NULL) - 7 * 24 * 3600;
+    time_t dayOne = 24 * 3600;
+    const char *labels[] = { "w24fz -r 0 4096", "w24ft -r txt pdf c", "w24fda -r (last week)", "dirlist -t -r",
+                             "w24fz -r 1000 1100", "w24fdb -r 1970-01-02", "w24fn -r (no match)" };
+    for (int query = 0; query < 7; query++) {
+        int runs = 0;
+        int matches = 0;
+        start = nowUs();
+        do {
+            archiveList list;
+            archiveListInit(&list);
+            w24Buffer dirs;
+            bufferInit(&dirs);
+            if (query == 0) {
+                matches = indexSelectSizeRange(&index, 0, 4096, 1, &list);
+            } else if (query == 1) {
+                matches = indexSelectExtensions(&index, extensions, 3, 1, &list);
+            } else if (query == 2) {
+                matches = indexSelectCreationTime(&index, weekAgo, 0, 1, &list);
+            } else if (query == 4) {
+                matches = indexSelectSizeRange(&index, 1000, 1100, 1, &list);
+            } else if (query == 5) {
+                matches = indexSelectCreationTime(&index, dayOne, 1, 1, &list);
+            } else if (query == 6) {
+                matches = indexLookup(&index, "no such file", 1, &found);
+            } else {
+                matches = indexDirectories(&index, 1, 1, 0, SIZE_MAX, &dirs);
+                bufferFree(&dirs);
+            }
+            archiveListFree(&list);
+            runs++;
+        } while (nowUs() - start < 200000);
+        printf("%-28s %12.1f us/query (%d matches)\n", labels[query], (nowUs() - start) / runs, matches);
+    }
+
+    // What the watcher pays per change event: a stat plus the column writes
+    int updates = t->count < 10000 ? t->count : 10000;
+    char name[PATH_MAX];
+    start = nowUs();
+    for (int i = 0; i < updates; i++) {
+        snprintf(name, sizeof(name), "%s", t->names + t->nameOffset[i]);
+        indexUpdate(&index, name);
+    }
+    if (updates > 0) {
+        printf("%-28s %12.3f us/update\n", "incremental update", (nowUs() - start) / updates);
+    }
+
+    indexFree(&index);
+}
+
+void indexExtensionBenchmark(void) {
+    const int sizes[] = { 10000, 100000, 1000000 };
+    const int rareFiles = 100;
+    const char *rare[] = { "rare" };
+    const char *several[] = { "RARE", "tar.gz", "none", "r" };
+
+    printf("%10s %22s %26s\n", "entries", "w24ft rare (100 files)", "w24ft RARE tar.gz none r");
+    for (int s = 0; s < 3; s++) {
+        // A synthetic index: mostly .dat files, a few .tar.gz, and a fixed number of .rare ones
+        w24Index index;
+        memset(&index, 0, sizeof(index));
+        pthread_rwlock_init(&index.lock, NULL);
+        pthread_mutex_init(&index.dirOrderLock, NULL);
+        w24IndexTable *t = &index.table;
+
+        walkEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.mode = S_IFREG | 0644;
+        entry.type = INDEX_TYPE_FILE;
+        int rareEvery = sizes[s] / rareFiles;
+        for (int i = 0; i < sizes[s]; i++) {
+            char name[64];
+            const char *extension = i % rareEvery == 0 ? "rare" : i % 1000 == 1 ? "tar.gz" : "dat";
+            snprintf(name, sizeof(name), "f%07d.%s", i, extension);
+            entry.size = i;
+            if (storeEntry(t, name, &entry) == -1) {
+                fprintf(stderr, "Out of memory building the synthetic index\n");
+                indexFree(&index);
+                return;
+            }
+        }
+
+        double perQuery[2];
+        for (int query = 0; query < 2; query++) {
+            int runs = 0;
+            double start = nowUs();
+            do {
+                archiveList list;
+                archiveListInit(&list);
+                if (query == 0) {
+                    indexSelectExtensions(&index, rare, 1, 0, &list);
+                } else {
+                    indexSelectExtensions(&index, several, 4, 0, &list);
+                }
+                archiveListFree(&list);
+                runs++;
+            } while (nowUs() - start < 200000);
+            perQuery[query] = (nowUs() - start) / runs;
+        }
+        printf("%10d %19.2f us %23.2f us\n", sizes[s], perQuery[0], perQuery[1]);
+
+        indexFree(&index);
+    }
+}
+
+void indexWalkBenchmark(const char *rootDir) {
+    // Past the CPU count too: on a cold cache more walkers keep more directory reads in flight
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cpus > 8 ? cpus : 8;
+
+    // One untimed walk so every run finds the inodes in cache
+    unsigned long syscalls = 0;
+    int entries = scanWithStat(rootDir, &syscalls);
+    printf("Walk of %s: %d entries, %d CPUs\n", rootDir, entries, cpus);
+    printf("%8s %12s %14s %9s\n", "threads", "ms", "entries/sec", "speedup");
+
+    double singleMs = 0;
+    for (int threads = 1;; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+        walkResult *results;
+        double start = nowUs();
+        int numResults = walkTree(rootDir, "", threads, &results);
+        double ms = (nowUs() - start) / 1000.0;
+        if (numResults == -1) {
+            return;
+        }
+        walkResultsFree(results, numResults);
+
+        if (threads == 1) {
+            singleMs = ms;
+        }
+        printf("%8d %12.1f %14.0f %8.2fx\n", threads, ms, entries / (ms / 1000.0), singleMs / ms);
+        if (threads >= maxThreads) {
+            break;
+        }
+    }
+}
+
+void indexScanBenchmark(const char *rootDir) {
+    unsigned long syscalls = 0;
+    int entries = scanWithStat(rootDir, &syscalls); // Untimed, to warm the inode and dentry caches
+    if (entries == 0) {
+        fprintf(stderr, "Nothing to scan in %s\n", rootDir);
+        return;
+    }
+    printf("Scan of %s: %d entries, one thread\n", rootDir, entries);
+    printf("%-32s %10s %12s %16s\n", "engine", "ms", "ns/entry", "syscalls/entry");
+
+    syscalls = 0;
+    double start = nowUs();
+    scanWithStat(rootDir, &syscalls);
+    double us = nowUs() - start;
+    printf("%-32s %10.1f %12.1f %16.2f\n", "readdir + stat(absolute path)", us / 1000.0, us * 1000.0 / entries,
+           (double)syscalls / entries);
+
+    walkResult *results;
+    start = nowUs();
+    if (walkTree(rootDir, "", 1, &results) == -1) {
+        return;
+    }
+    us = nowUs() - start;
+    printf("%-32s %10.1f %12.1f %16.2f\n", "getdents64 + statx(dir fd)", us / 1000.0,
+           us * 1000.0 / results[0].count, (double)results[0].syscalls / results[0].count);
+    walkResultsFree(results, 1);
+}
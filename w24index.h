@@ -0,0 +1,147 @@
+//Resident metadata index of the served directory, so commands answer from memory instead of readdir+stat.
+#ifndef W24INDEX_H
+#define W24INDEX_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "w24archive.h"
+#include "w24proto.h"
+#include "w24walk.h"
+
+//Ids of the files with one extension, in ascending order.
+typedef struct indexPostings {
+    uint32_t *ids;
+    int count;
+    int capacity;
+} indexPostings;
+
+//One column per attribute (structure of arrays): a filter walks only the column it tests, which keeps
+//scans over a million entries inside a few cache-friendly arrays. Entry ids stay stable until the entry
+//is removed. Entries cover the whole tree and are named by their path relative to the root.
+typedef struct w24IndexTable {
+    int count;    // Ids in use, including free ones
+    int capacity;
+    int live;     // Entries that exist
+
+    // Columns, indexed by entry id
+    uint32_t *nameOffset; // Into names
+    int64_t *size;
+    int64_t *btime;       // Birth time, or ctime where the filesystem does not record one
+    int64_t *mtime;
+    uint32_t *mode;
+    uint8_t *type;        // INDEX_TYPE_*
+    uint16_t *depth;      // Slashes in the path: 0 for the top level
+    uint32_t *baseNext;   // Next entry id + 1 with the same base name (0 ends the chain)
+
+    // NUL-terminated paths, back to back; names of removed entries are garbage until the next compaction
+    char *names;
+    size_t namesLen;
+    size_t namesCap;
+    size_t namesGarbage;
+
+    // Open-addressing table from name to entry id + 1 (0 marks an empty slot)
+    uint32_t *nameSlots;
+    uint32_t nameMask;
+    // Same size, from base name to the first entry id + 1 of its chain, so w24fn -r need not scan
+    uint32_t *baseSlots;
+
+    // Ids of regular files ordered by (size, id) and by (btime, id), so range filters binary-search
+    // to the first match instead of testing every entry
+    uint32_t *bySize;
+    uint32_t *byBirth;
+    int numFiles;
+    int sortedCap;
+
+    // Ids of removed entries, reused by the next additions
+    uint32_t *freeIds;
+    int numFree;
+    int freeCap;
+
+    // Inverted extension index: every lowercased dot-suffix of a file's base name ("tar.gz" and "gz" for
+    // a.TAR.gz) maps to the ids of the files that have it. Slots hold extension number + 1.
+    char **extNames;
+    indexPostings *postings;
+    int numExts;
+    int extCap;
+    uint32_t *extSlots;
+    uint32_t extMask;
+
+    unsigned long dirChanges; // Bumped whenever a directory is added, removed or changes birth time
+} w24IndexTable;
+
+//A dirlist order (by name or birth time, top level or whole tree) as entry ids. It is reused until the
+//directories change, so paging through a large listing sorts once.
+typedef struct indexDirOrder {
+    uint32_t *ids;
+    int count;
+    unsigned long dirChanges; // Of the table it was built from
+} indexDirOrder;
+
+typedef struct w24Index {
+    char rootDir[256];
+    int walkThreads;          // Threads a full scan walks the tree with
+    w24IndexTable table;
+    unsigned long generation; // Bumped on every change
+    pthread_rwlock_t lock;    // Readers are queries; the watcher is the only writer
+    indexDirOrder dirOrders[4];   // Indexed by byCreationTime * 2 + recursive
+    pthread_mutex_t dirOrderLock; // Queries rebuild the orders while holding only the read lock
+    uint64_t *scanned;            // NULL, or a counter the entries each query examines are added to
+} w24Index;
+
+//What w24fn reports about one entry.
+typedef struct w24IndexEntry {
+    char path[PATH_MAX];
+    int64_t size;
+    int64_t btime;
+    int64_t mtime;
+    uint32_t mode;
+    int type;
+} w24IndexEntry;
+
+//Walk the tree under rootDir into the index with walkThreads threads (0 for one per CPU). Returns -1 if the
+//directory cannot be read.
+int indexInit(w24Index *index, const char *rootDir, int walkThreads);
+void indexFree(w24Index *index);
+
+//Rescan rootDir from scratch. The scan runs without the lock; only the swap blocks queries.
+int indexRescan(w24Index *index);
+
+//Re-stat one path relative to rootDir and add, update or remove its entry.
+int indexUpdate(w24Index *index, const char *path);
+
+//Queries. Each takes the read lock, copies what it needs and returns the number of matches (-1 on failure).
+//Without recursive only top-level entries match; with it the whole tree does, and names are paths
+//relative to rootDir. A recursive lookup matches the base name and reports the shallowest such entry.
+int indexLookup(w24Index *index, const char *name, int recursive, w24IndexEntry *out);
+//indexDirectories appends the names at positions [offset, offset + limit) of the order to out, one per line.
+int indexDirectories(w24Index *index, int byCreationTime, int recursive, size_t offset, size_t limit, w24Buffer *out);
+int indexSelectSizeRange(w24Index *index, long long minSize, long long maxSize, int recursive, archiveList *out);
+int indexSelectExtensions(w24Index *index, const char **extensions, int numExtensions, int recursive,
+                          archiveList *out);
+int indexSelectCreationTime(w24Index *index, time_t targetDate, int beforeOrEqual, int recursive, archiveList *out);
+
+//Bytes of memory the index holds, for the benchmark.
+size_t indexMemoryUsage(w24Index *index);
+
+//Keep the index current from inotify events on every directory of the tree, on a background thread. New
+//directories are walked and watched as they appear; an event queue overflow or a directory being moved
+//triggers a rescan on that thread. Returns -1 if the watch cannot be set up.
+int indexWatch(w24Index *index);
+
+//serverw24 -b index: build time, memory per entry and query latency against a readdir+stat scan of rootDir.
+void indexBenchmark(const char *rootDir);
+
+//serverw24 -b walk: full-tree walk time of rootDir with 1, 2, 4... threads up to one per CPU (at least 8).
+void indexWalkBenchmark(const char *rootDir);
+
+//serverw24 -b scan: time and system calls per entry of the walker's getdents64+statx loop against
+//readdir plus stat() of an absolute path, both on one thread.
+void indexScanBenchmark(const char *rootDir);
+
+//serverw24 -b ext: w24ft latency on synthetic indexes of growing size with the same number of matches.
+void indexExtensionBenchmark(void);
+
+#endif
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "w24metrics.h"
+
+static uint64_t load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void add(uint64_t *counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+//Bucket of a latency: its top METRICS_SUB_BUCKET_BITS + 1 significant bits.
+static int bucketIndex(uint64_t us) {
+    if (us < METRICS_SUB_BUCKETS) {
+        return (int)us;
+    }
+    int exponent = 63 - __builtin_clzll(us);
+    if (exponent >= METRICS_MAX_BITS) {
+        return METRICS_BUCKETS - 1;
+    }
+    int shift = exponent - METRICS_SUB_BUCKET_BITS;
+    return (shift + 1) * METRICS_SUB_BUCKETS + (int)((us >> shift) - METRICS_SUB_BUCKETS);
+}
+
+//Largest latency that falls in a bucket, which is what a quantile in it is reported as.
+static uint64_t bucketHighest(int index) {
+    if (index < METRICS_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / METRICS_SUB_BUCKETS - 1;
+    uint64_t lowest = (uint64_t)(METRICS_SUB_BUCKETS + index % METRICS_SUB_BUCKETS) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+w24Metrics *metricsCreate(const char *node, int port) {
+    char name[64];
+    snprintf(name, sizeof(name), METRICS_SHM_FMT, port);
+
+    // A segment left by an earlier run is replaced, not reused: a reader may still have it mapped
+    w24Metrics *metrics = MAP_FAILED;
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) {
+        if (ftruncate(fd, sizeof(w24Metrics)) == 0) {
+            metrics = mmap(NULL, sizeof(w24Metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+
+    if (metrics == MAP_FAILED) {
+        perror("Failed to create the metrics segment");
+        shm_unlink(name);
+        metrics = calloc(1, sizeof(w24Metrics));
+        if (!metrics) {
+            return NULL;
+        }
+    }
+
+    metrics->version = METRICS_VERSION;
+    metrics->pid = getpid();
+    snprintf(metrics->node, sizeof(metrics->node), "%s", node);
+    metrics->startTime = time(NULL);
+    // Readers check the magic, so it goes in last
+    __atomic_store_n(&metrics->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    return metrics;
+}
+
+void metricsRemove(int port) {
+    char name[64];
+    snprintf(name, sizeof(name), METRICS_SHM_FMT, port);
+    shm_unlink(name);
+}
+
+const w24Metrics *metricsOpen(int port) {
+    char name[64];
+    snprintf(name, sizeof(name), METRICS_SHM_FMT, port);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    w24Metrics *metrics = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == sizeof(w24Metrics)) {
+        metrics = mmap(NULL, sizeof(w24Metrics), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (metrics == MAP_FAILED) {
+        return NULL;
+    }
+
+    // A node that was killed leaves its segment behind
+    if (__atomic_load_n(&metrics->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC || metrics->version != METRICS_VERSION ||
+        (kill(metrics->pid, 0) == -1 && errno == ESRCH)) {
+        munmap(metrics, sizeof(w24Metrics));
+        return NULL;
+    }
+    return metrics;
+}
+
+void metricsClose(const w24Metrics *metrics) {
+    munmap((void *)metrics, sizeof(w24Metrics));
+}
+
+void metricsRequest(w24Metrics *metrics, int opcode, uint64_t serviceUs, uint64_t bytesSent) {
+    metricsCommand *command = &metrics->commands[opcode > 0 && opcode <= OP_MAX ? opcode : 0];
+    add(&command->requests, 1);
+    add(&command->totalUs, serviceUs);
+    add(&command->bytesSent, bytesSent);
+    add(&command->buckets[bucketIndex(serviceUs)], 1);
+}
+
+void metricsConnection(w24Metrics *metrics, int opened) {
+    if (opened) {
+        add(&metrics->connections, 1);
+        add(&metrics->activeConnections, 1);
+    } else {
+        __atomic_fetch_sub(&metrics->activeConnections, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void metricsArchive(w24Metrics *metrics, uint64_t files, uint64_t inputBytes, uint64_t outputBytes) {
+    add(&metrics->filesArchived, files);
+    // Only archives compressed for this request say anything about the compression ratio
+    if (inputBytes > 0) {
+        add(&metrics->archiveInputBytes, inputBytes);
+        add(&metrics->archiveOutputBytes, outputBytes);
+    }
+}
+
+static int appendf(w24Buffer *out, const char *format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) {
+        return -1;
+    }
+    return bufferAppend(out, line, length < (int)sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
+static const char *commandLabel(int opcode) {
+    const char *name = opcodeCommand(opcode);
+    return name ? name : "other";
+}
+
+//One sample per node of a node-wide counter or gauge at offset in w24Metrics.
+static int formatNodeCounter(const w24Metrics **nodes, int count, w24Buffer *out, const char *name,
+                             const char *type, const char *help, size_t offset) {
+    if (appendf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t value = load((const uint64_t *)((const char *)nodes[i] + offset));
+        // The gauges count down as well as up
+        long long signedValue = (long long)value;
+        if (appendf(out, "%s{node=\"%s\"} %lld\n", name, nodes[i]->node, signedValue) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//The quantiles of one command's latencies, from a snapshot of its histogram.
+static int formatLatency(const w24Metrics *metrics, int opcode, w24Buffer *out) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    const char *name = "w24_request_duration_seconds";
+    const metricsCommand *command = &metrics->commands[opcode];
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        buckets[i] = load(&command->buckets[i]);
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    int bucket = 0;
+    uint64_t seen = buckets[0];
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        uint64_t rank = (uint64_t)(quantiles[q] * total);
+        if (rank == 0 || rank < quantiles[q] * total) {
+            rank++;
+        }
+        while (seen < rank) {
+            seen += buckets[++bucket];
+        }
+        if (appendf(out, "%s{node=\"%s\",command=\"%s\",quantile=\"%g\"} %.6f\n", name, metrics->node,
+                    commandLabel(opcode), quantiles[q], bucketHighest(bucket) / 1e6) == -1) {
+            return -1;
+        }
+    }
+    if (appendf(out, "%s_sum{node=\"%s\",command=\"%s\"} %.6f\n", name, metrics->node, commandLabel(opcode),
+                load(&command->totalUs) / 1e6) == -1 ||
+        appendf(out, "%s_count{node=\"%s\",command=\"%s\"} %llu\n", name, metrics->node, commandLabel(opcode),
+                (unsigned long long)total) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int metricsFormat(const w24Metrics **nodes, int count, w24Buffer *out) {
+    if (formatNodeCounter(nodes, count, out, "w24_start_time_seconds", "gauge", "When the node started.",
+                          offsetof(w24Metrics, startTime)) == -1 ||
+        formatNodeCounter(nodes, count, out, "w24_connections_total", "counter", "Client connections served.",
+                          offsetof(w24Metrics, connections)) == -1 ||
+        formatNodeCounter(nodes, count, out, "w24_active_connections", "gauge", "Client connections open now.",
+                          offsetof(w24Metrics, activeConnections)) == -1) {
+        return -1;
+    }
+
+    // Commands show up once they have been used
+    if (appendf(out, "# HELP w24_request_duration_seconds Time to serve a request, by command.\n"
+                     "# TYPE w24_request_duration_seconds summary\n") == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int opcode = 0; opcode <= OP_MAX; opcode++) {
+            if (formatLatency(nodes[i], opcode, out) == -1) {
+                return -1;
+            }
+        }
+    }
+    if (appendf(out, "# HELP w24_bytes_sent_total Reply bytes sent, by command.\n"
+                     "# TYPE w24_bytes_sent_total counter\n") == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int opcode = 0; opcode <= OP_MAX; opcode++) {
+            const metricsCommand *command = &nodes[i]->commands[opcode];
+            if (load(&command->requests) > 0 &&
+                appendf(out, "w24_bytes_sent_total{node=\"%s\",command=\"%s\"} %llu\n", nodes[i]->node,
+                        commandLabel(opcode), (unsigned long long)load(&command->bytesSent)) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    if (formatNodeCounter(nodes, count, out, "w24_files_scanned_total", "counter",
+                          "Index entries examined by queries.", offsetof(w24Metrics, filesScanned)) == -1 ||
+        formatNodeCounter(nodes, count, out, "w24_files_archived_total", "counter", "Files in the archives sent.",
+                          offsetof(w24Metrics, filesArchived)) == -1 ||
+        formatNodeCounter(nodes, count, out, "w24_archive_input_bytes_total", "counter",
+                          "Size of the files in archives compressed for a client.",
+                          offsetof(w24Metrics, archiveInputBytes)) == -1 ||
+        formatNodeCounter(nodes, count, out, "w24_archive_output_bytes_total", "counter",
+                          "Bytes sent for archives compressed for a client.",
+                          offsetof(w24Metrics, archiveOutputBytes)) == -1) {
+        return -1;
+    }
+
+    if (appendf(out, "# HELP w24_archive_compression_ratio Archive bytes sent per byte of input.\n"
+                     "# TYPE w24_archive_compression_ratio gauge\n") == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        uint64_t input = load(&nodes[i]->archiveInputBytes);
+        if (input > 0 && appendf(out, "w24_archive_compression_ratio{node=\"%s\"} %.4f\n", nodes[i]->node,
+                                 (double)load(&nodes[i]->archiveOutputBytes) / input) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+//Counters and per-command latency histograms of one server node, kept in a shared memory segment
+//(/w24metrics-<port>) so other processes can read them while the node runs: serverw24 exports its mirrors'
+//next to its own. Recording is a few relaxed atomic adds, so worker threads never take a lock for it.
+#ifndef W24METRICS_H
+#define W24METRICS_H
+
+#include <stdint.h>
+
+#include "w24proto.h"
+
+#define METRICS_SHM_FMT "/w24metrics-%d"
+#define METRICS_MAGIC 0x7732346d // "w24m"
+#define METRICS_VERSION 1
+
+//Latencies are bucketed HDR style, in microseconds: exact below 8 us, then 8 buckets per power of two, so a
+//bucket is at most 12.5% wide. Anything from 2^36 us (19 hours) up lands in the last bucket.
+#define METRICS_SUB_BUCKET_BITS 3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_BITS 36
+#define METRICS_BUCKETS ((METRICS_MAX_BITS - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS)
+
+typedef struct metricsCommand {
+    uint64_t requests;
+    uint64_t totalUs;
+    uint64_t bytesSent;
+    uint64_t buckets[METRICS_BUCKETS];
+} metricsCommand;
+
+typedef struct w24Metrics {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;                // Of the node that writes it
+    char node[32];
+    int64_t startTime;
+    uint64_t connections;       // Accepted and served (not turned away)
+    uint64_t activeConnections;
+    uint64_t filesScanned;      // Index entries the queries examined
+    uint64_t filesArchived;     // Members of the archives sent
+    uint64_t archiveInputBytes; // Size of the members of archives compressed for a client...
+    uint64_t archiveOutputBytes; // ...and the bytes those archives came to
+    metricsCommand commands[OP_MAX + 1]; // By opcode; 0 counts commands no opcode names
+} w24Metrics;
+
+//Create the segment of the node listening on port, zeroed, replacing any an earlier run left. If shared memory is not available
+//the metrics are kept in private memory instead, so recording always works; only other processes miss them.
+w24Metrics *metricsCreate(const char *node, int port);
+//Remove the segment's name when the node stops serving. Its mapping stays valid for threads still recording.
+void metricsRemove(int port);
+
+//Map the segment of the node on port read-only. Returns NULL if there is none or its node is gone.
+const w24Metrics *metricsOpen(int port);
+void metricsClose(const w24Metrics *metrics);
+
+//A request finished after serviceUs, sending bytesSent bytes.
+void metricsRequest(w24Metrics *metrics, int opcode, uint64_t serviceUs, uint64_t bytesSent);
+//A connection started (opened 1) or ended (opened 0).
+void metricsConnection(w24Metrics *metrics, int opened);
+//An archive of files members went out. inputBytes is 0 if none had to be compressed (a cache hit).
+void metricsArchive(w24Metrics *metrics, uint64_t files, uint64_t inputBytes, uint64_t outputBytes);
+
+//Append the nodes' metrics to out in the Prometheus text format, every series labelled with its node.
+//Latencies are summaries with the 0.5, 0.9, 0.99 and 0.999 quantiles. Returns -1 if out cannot grow.
+int metricsFormat(const w24Metrics **nodes, int count, w24Buffer *out);
+
+#endif
@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
+
+#include "w24proto.h"
+
+void bufferInit(w24Buffer *buffer) {
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+int bufferAppend(w24Buffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        // Doubling keeps appends amortized O(1) however large the reply grows
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+void bufferFree(w24Buffer *buffer) {
+    free(buffer->data);
+    bufferInit(buffer);
+}
+
+//Send the whole buffer. Non-blocking sockets wait for POLLOUT whenever the socket buffer is full.
+static int sendAllFlags(int socket, const void *data, size_t length, int flags) {
+    const char *ptr = data;
+
+    while (length > 0) {
+        ssize_t sent = send(socket, ptr, length, MSG_NOSIGNAL | flags);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = socket, .events = POLLOUT };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        ptr += sent;
+        length -= sent;
+    }
+
+    return 0;
+}
+
+int sendAll(int socket, const void *data, size_t length) {
+    return sendAllFlags(socket, data, length, 0);
+}
+
+//Send length bytes of fd starting at offset with sendfile, so file data goes from the page cache to the
+//socket without passing through user space. Files sendfile cannot read are copied instead; a file that
+//shrank is padded with zeros, so the receiver always gets the length it was promised.
+static int sendFileRange(int socket, int fd, off_t offset, size_t length) {
+    int copy = 0;
+    while (length > 0) {
+        ssize_t sent;
+        if (!copy) {
+            sent = sendfile(socket, fd, &offset, length);
+            if (sent == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                copy = 1;
+                continue;
+            }
+        } else {
+            char buffer[65536];
+            sent = pread(fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+            if (sent > 0 && sendAll(socket, buffer, sent) == -1) {
+                return -1;
+            }
+            if (sent > 0) {
+                offset += sent;
+            }
+        }
+
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = socket, .events = POLLOUT };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            if (copy) {
+                sent = 0; // Read error: pad like a truncated file
+            } else {
+                return -1;
+            }
+        }
+        if (sent == 0) {
+            static const char zeros[4096];
+            size_t pad = length < sizeof(zeros) ? length : sizeof(zeros);
+            if (sendAll(socket, zeros, pad) == -1) {
+                return -1;
+            }
+            sent = pad;
+        }
+        length -= sent;
+    }
+    return 0;
+}
+
+int recvAll(int socket, void *data, size_t length) {
+    char *ptr = data;
+
+    while (length > 0) {
+        ssize_t bytesRead = recv(socket, ptr, length, 0);
+        if (bytesRead == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = socket, .events = POLLIN };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        if (bytesRead == 0) {
+            return -1;
+        }
+        ptr += bytesRead;
+        length -= bytesRead;
+    }
+
+    return 0;
+}
+
+int sendChunk(int socket, const void *data, uint32_t length) {
+    uint32_t prefix = htonl(length);
+
+    if (length == 0) {
+        return sendAll(socket, &prefix, sizeof(prefix));
+    }
+
+    // Prefix and data in one gathered send so small chunks go out in a single segment
+    struct iovec iov[2] = {
+        { .iov_base = &prefix, .iov_len = sizeof(prefix) },
+        { .iov_base = (void *)data, .iov_len = length },
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+
+    if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+    }
+    if (sent == -1) {
+        sent = 0;
+    }
+    if ((size_t)sent == sizeof(prefix) + length) {
+        return 0;
+    }
+
+    // Short write: finish the prefix, then the data
+    if ((size_t)sent < sizeof(prefix)) {
+        if (sendAll(socket, (char *)&prefix + sent, sizeof(prefix) - sent) == -1) {
+            return -1;
+        }
+        sent = sizeof(prefix);
+    }
+    return sendAll(socket, (const char *)data + (sent - sizeof(prefix)), length - (sent - sizeof(prefix)));
+}
+
+static const char *opcodeCommands[OP_MAX + 1] = {
+    NULL, "dirlist", "w24fn", "w24fz", "w24ft", "w24fdb", "w24fda", "w24stats", "quitc", "w24get", "w24metrics",
+};
+
+const char *opcodeCommand(int opcode) {
+    if (opcode <= 0 || opcode > OP_MAX) {
+        return NULL;
+    }
+    return opcodeCommands[opcode];
+}
+
+int commandOpcode(const char *command) {
+    for (int opcode = 1; opcode <= OP_MAX; opcode++) {
+        if (strcmp(command, opcodeCommands[opcode]) == 0) {
+            return opcode;
+        }
+    }
+    return -1;
+}
+
+void encodeHeader(const w24Header *header, unsigned char *buffer) {
+    uint16_t magic = htons(header->magic);
+    uint32_t requestId = htonl(header->requestId);
+    uint16_t flags = htons(header->flags);
+    uint16_t status = htons(header->status);
+    uint32_t payloadLength = htonl(header->payloadLength);
+
+    memcpy(buffer, &magic, 2);
+    buffer[2] = header->version;
+    buffer[3] = header->opcode;
+    memcpy(buffer + 4, &requestId, 4);
+    memcpy(buffer + 8, &flags, 2);
+    memcpy(buffer + 10, &status, 2);
+    memcpy(buffer + 12, &payloadLength, 4);
+}
+
+int decodeHeader(const unsigned char *buffer, w24Header *header) {
+    uint16_t magic, flags, status;
+    uint32_t requestId, payloadLength;
+
+    memcpy(&magic, buffer, 2);
+    memcpy(&requestId, buffer + 4, 4);
+    memcpy(&flags, buffer + 8, 2);
+    memcpy(&status, buffer + 10, 2);
+    memcpy(&payloadLength, buffer + 12, 4);
+
+    header->magic = ntohs(magic);
+    header->version = buffer[2];
+    header->opcode = buffer[3];
+    header->requestId = ntohl(requestId);
+    header->flags = ntohs(flags);
+    header->status = ntohs(status);
+    header->payloadLength = ntohl(payloadLength);
+
+    if (header->magic != W24_MAGIC || header->version != W24_VERSION) {
+        return -1;
+    }
+    return 0;
+}
+
+int sendFrame(int socket, const w24Header *header, const void *payload) {
+    unsigned char encoded[W24_HEADER_LEN];
+    encodeHeader(header, encoded);
+
+    if (header->payloadLength == 0) {
+        return sendAll(socket, encoded, sizeof(encoded));
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = encoded, .iov_len = sizeof(encoded) },
+        { .iov_base = (void *)payload, .iov_len = header->payloadLength },
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+
+    if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+    }
+    if (sent == -1) {
+        sent = 0;
+    }
+
+    // Short write: finish the header, then the payload
+    if ((size_t)sent < sizeof(encoded)) {
+        if (sendAll(socket, encoded + sent, sizeof(encoded) - sent) == -1) {
+            return -1;
+        }
+        sent = sizeof(encoded);
+    }
+    size_t payloadSent = sent - sizeof(encoded);
+    return sendAll(socket, (const char *)payload + payloadSent, header->payloadLength - payloadSent);
+}
+
+int recvFrame(int socket, w24Header *header, char **payload) {
+    unsigned char encoded[W24_HEADER_LEN];
+    *payload = NULL;
+
+    if (recvAll(socket, encoded, sizeof(encoded)) == -1) {
+        return -1;
+    }
+    if (decodeHeader(encoded, header) == -1 || header->payloadLength > W24_MAX_PAYLOAD) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    *payload = malloc(header->payloadLength + 1);
+    if (*payload == NULL) {
+        return -1;
+    }
+    if (recvAll(socket, *payload, header->payloadLength) == -1) {
+        free(*payload);
+        *payload = NULL;
+        return -1;
+    }
+    (*payload)[header->payloadLength] = '\0';
+    return 0;
+}
+
+//Frame header for a reply to the given request.
+static void replyHeader(const w24Reply *reply, w24Header *header, int flags, int status, size_t length) {
+    header->magic = W24_MAGIC;
+    header->version = W24_VERSION;
+    header->opcode = reply->opcode;
+    header->requestId = reply->requestId;
+    header->flags = flags;
+    header->status = status;
+    header->payloadLength = length;
+}
+
+//Count bytes of a reply that went out (or were queued for the output).
+static int countSent(const w24Reply *reply, int result, size_t length) {
+    if (result == 0 && reply->sent) {
+        *reply->sent += length;
+    }
+    return result;
+}
+
+//Send one frame of a reply without letting concurrent replies on the same socket cut into it.
+static int sendReplyFrame(const w24Reply *reply, int flags, int status, const void *payload, size_t length) {
+    w24Header header;
+    replyHeader(reply, &header, flags, status, length);
+
+    if (reply->output) {
+        // The output queues whole frames, so they cannot interleave either
+        unsigned char encoded[W24_HEADER_LEN];
+        encodeHeader(&header, encoded);
+        struct iovec iov[2] = {
+            { .iov_base = encoded, .iov_len = sizeof(encoded) },
+            { .iov_base = (void *)payload, .iov_len = length },
+        };
+        return countSent(reply, reply->output->write(reply->output, iov, length > 0 ? 2 : 1), W24_HEADER_LEN + length);
+    }
+
+    if (reply->writeLock) {
+        pthread_mutex_lock(reply->writeLock);
+    }
+    int result = sendFrame(reply->socket, &header, payload);
+    if (reply->writeLock) {
+        pthread_mutex_unlock(reply->writeLock);
+    }
+    return countSent(reply, result, W24_HEADER_LEN + length);
+}
+
+//Text mode bytes of a reply, through the output if there is one.
+static int sendReplyText(const w24Reply *reply, const void *data, size_t length) {
+    if (!reply->output) {
+        return countSent(reply, sendAll(reply->socket, data, length), length);
+    }
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = length };
+    return countSent(reply, reply->output->write(reply->output, &iov, 1), length);
+}
+
+//One text mode archive chunk (length 0 ends the archive), through the output if there is one.
+static int sendReplyChunk(const w24Reply *reply, const void *data, uint32_t length) {
+    if (!reply->output) {
+        return countSent(reply, sendChunk(reply->socket, data, length), sizeof(uint32_t) + length);
+    }
+    uint32_t prefix = htonl(length);
+    struct iovec iov[2] = {
+        { .iov_base = &prefix, .iov_len = sizeof(prefix) },
+        { .iov_base = (void *)data, .iov_len = length },
+    };
+    return countSent(reply, reply->output->write(reply->output, iov, length > 0 ? 2 : 1), sizeof(prefix) + length);
+}
+
+int sendReply(const w24Reply *reply, int status, const char *text, size_t length) {
+    if (!reply->binary) {
+        return sendReplyText(reply, text, length);
+    }
+
+    // Split large answers into frames no bigger than the protocol allows
+    do {
+        size_t frameLength = length > W24_MAX_PAYLOAD ? W24_MAX_PAYLOAD : length;
+        int flags = frameLength < length ? FLAG_MORE : 0;
+        if (sendReplyFrame(reply, flags, status, text, frameLength) == -1) {
+            return -1;
+        }
+        text += frameLength;
+        length -= frameLength;
+    } while (length > 0);
+
+    return 0;
+}
+
+int sendArchiveBegin(const w24Reply *reply, const char *archiveName, const w24ArchiveInfo *info) {
+    char text[512];
+    int nameLength = snprintf(text, sizeof(text), "%s", archiveName);
+    if (nameLength >= (int)sizeof(text)) {
+        nameLength = sizeof(text) - 1;
+    }
+    int length = nameLength;
+    if (info && info->resultId[0] != '\0') {
+        length += snprintf(text + nameLength, sizeof(text) - nameLength, "%cid=%s offset=%llu size=%lld",
+                           reply->binary ? '\0' : ' ', info->resultId, info->offset, info->size);
+    }
+
+    if (!reply->binary) {
+        char header[600];
+        int headerLength = snprintf(header, sizeof(header), "%s %s\n", ARCHIVE_STREAM_MAGIC, text);
+        return sendReplyText(reply, header, headerLength);
+    }
+
+    return sendReplyFrame(reply, FLAG_ARCHIVE | FLAG_MORE, STATUS_OK, text, length);
+}
+
+int sendArchiveData(const w24Reply *reply, const void *data, size_t length) {
+    const char *ptr = data;
+
+    while (length > 0) {
+        size_t chunk = length > MAX_CHUNK_LEN ? MAX_CHUNK_LEN : length;
+        int result;
+        if (reply->binary) {
+            result = sendReplyFrame(reply, FLAG_ARCHIVE | FLAG_MORE, STATUS_OK, ptr, chunk);
+        } else {
+            result = sendReplyChunk(reply, ptr, chunk);
+        }
+        if (result == -1) {
+            return -1;
+        }
+        ptr += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+int sendArchiveFile(const w24Reply *reply, int fd, off_t offset, size_t length) {
+    // sendfile writes the socket itself: with an output, wait for the queued frames and keep others out
+    pthread_mutex_t *writeLock = reply->output ? NULL : reply->writeLock;
+    if (reply->output && reply->output->claim(reply->output) == -1) {
+        return -1;
+    }
+
+    int result = 0;
+    while (length > 0 && result == 0) {
+        size_t chunk = length > MAX_CHUNK_LEN ? MAX_CHUNK_LEN : length;
+        unsigned char prefix[W24_HEADER_LEN];
+        size_t prefixLength;
+        if (reply->binary) {
+            w24Header header;
+            replyHeader(reply, &header, FLAG_ARCHIVE | FLAG_MORE, STATUS_OK, chunk);
+            encodeHeader(&header, prefix);
+            prefixLength = W24_HEADER_LEN;
+        } else {
+            uint32_t chunkLength = htonl(chunk);
+            memcpy(prefix, &chunkLength, sizeof(chunkLength));
+            prefixLength = sizeof(chunkLength);
+        }
+
+        // The frame header and its file data go out together under the lock, like any other frame
+        if (writeLock) {
+            pthread_mutex_lock(writeLock);
+        }
+        result = sendAllFlags(reply->socket, prefix, prefixLength, MSG_MORE);
+        if (result == 0) {
+            result = sendFileRange(reply->socket, fd, offset, chunk);
+        }
+        if (writeLock) {
+            pthread_mutex_unlock(writeLock);
+        }
+        countSent(reply, result, prefixLength + chunk);
+        offset += chunk;
+        length -= chunk;
+    }
+
+    if (reply->output) {
+        reply->output->release(reply->output);
+    }
+    return result;
+}
+
+int sendArchiveEnd(const w24Reply *reply) {
+    if (!reply->binary) {
+        return sendReplyChunk(reply, NULL, 0);
+    }
+
+    return sendReplyFrame(reply, FLAG_ARCHIVE, STATUS_OK, NULL, 0);
+}
+
+void parseArchiveInfo(const char *payload, size_t length, w24ArchiveInfo *info) {
+    memset(info, 0, sizeof(*info));
+    info->size = -1;
+
+    size_t nameLength = strnlen(payload, length);
+    if (nameLength + 1 >= length) {
+        return;
+    }
+    const char *id = strstr(payload + nameLength + 1, "id=");
+    const char *offset = strstr(payload + nameLength + 1, "offset=");
+    const char *size = strstr(payload + nameLength + 1, "size=");
+    if (id) {
+        size_t idLength = strspn(id + 3, "0123456789abcdef");
+        if (idLength == W24_RESULT_ID_LEN) {
+            memcpy(info->resultId, id + 3, idLength);
+        }
+    }
+    if (offset) {
+        info->offset = strtoull(offset + 7, NULL, 10);
+    }
+    if (size) {
+        info->size = strtoll(size + 5, NULL, 10);
+    }
+}
@@ -0,0 +1,140 @@
+//Wire protocol shared by clientw24 and the servers.
+#ifndef W24PROTO_H
+#define W24PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//Binary protocol (version 1). Every message is a 16-byte header in network byte order followed by the payload:
+//  magic (2) | version (1) | opcode (1) | request id (4) | flags (2) | status (2) | payload length (4)
+//Requests carry the command arguments as text ("-a", "100 2000", "txt pdf", ...). A response is one or more
+//frames with the request id and opcode of its request; every frame but the last has FLAG_MORE set.
+#define W24_MAGIC 0x5732 // "W2": no text command starts with it, which is how servers tell the two modes apart
+#define W24_VERSION 1
+#define W24_HEADER_LEN 16
+#define W24_MAX_PAYLOAD (16 * 1024 * 1024)
+#define W24_MAX_REQUEST_PAYLOAD (64 * 1024)
+
+//Opcodes, one per client command
+#define OP_DIRLIST 1
+#define OP_W24FN 2
+#define OP_W24FZ 3
+#define OP_W24FT 4
+#define OP_W24FDB 5
+#define OP_W24FDA 6
+#define OP_W24STATS 7
+#define OP_QUITC 8
+#define OP_W24GET 9
+#define OP_W24METRICS 10
+#define OP_MAX 10
+
+//Response flags
+#define FLAG_MORE 0x0001    // More frames follow for this request
+#define FLAG_ARCHIVE 0x0002 // Archive stream: the first frame carries the file name, the rest the compressed bytes
+
+//Response status
+#define STATUS_OK 0
+#define STATUS_NOT_FOUND 1
+#define STATUS_BAD_REQUEST 2
+#define STATUS_ERROR 3
+
+typedef struct w24Header {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint32_t requestId;
+    uint16_t flags;
+    uint16_t status;
+    uint32_t payloadLength;
+} w24Header;
+
+//Where a server's replies go when it does not write the socket itself (serverw24's io_uring reactor queues
+//them and sends them asynchronously). write takes one whole frame, or one piece of a text reply, as a gather
+//list; it keeps its own copy and may block while too much is queued. claim waits until everything queued is
+//sent and hands the socket to the caller (for sendfile) until release. Both return -1 once the client is gone.
+typedef struct w24Output {
+    int (*write)(struct w24Output *output, const struct iovec *iov, int count);
+    int (*claim)(struct w24Output *output);
+    void (*release)(struct w24Output *output);
+} w24Output;
+
+//Where and how a server answers one request: binary frames tagged with the request id,
+//or the unframed text replies legacy clients expect. Requests running concurrently on one connection
+//share writeLock (NULL if there is no concurrency), which is held for each whole frame.
+typedef struct w24Reply {
+    int socket;
+    int binary;
+    uint32_t requestId;
+    uint8_t opcode;
+    pthread_mutex_t *writeLock;
+    w24Output *output; // NULL: write the socket directly
+    unsigned long long *sent; // NULL, or where to add the bytes of the reply as they go out
+} w24Reply;
+
+//Text mode archive replies start with the line "W24ARCHIVE <file name>[ <info>]\n", followed by chunks of
+//[4-byte big-endian length][data]. A zero-length chunk ends the archive.
+#define ARCHIVE_STREAM_MAGIC "W24ARCHIVE"
+#define MAX_CHUNK_LEN (1024 * 1024)
+
+//A result id names one whole archive, so any part of it can be fetched again later (w24get): 32 hex digits.
+#define W24_RESULT_ID_LEN 32
+
+//Where the bytes of an archive reply sit in the whole archive. It travels after the file name in the first
+//archive frame (binary: "name\0info", text: "name info"), as "id=<result id> offset=<n> size=<n>".
+typedef struct w24ArchiveInfo {
+    char resultId[W24_RESULT_ID_LEN + 1]; // "" if the archive cannot be fetched again
+    unsigned long long offset;            // Of the first byte sent
+    long long size;                       // Of the whole archive; -1 if not known before it is sent
+} w24ArchiveInfo;
+
+//Growable byte buffer for replies assembled piece by piece.
+typedef struct w24Buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} w24Buffer;
+
+void bufferInit(w24Buffer *buffer);
+//Returns -1 on allocation failure, leaving the buffer as it was.
+int bufferAppend(w24Buffer *buffer, const void *data, size_t length);
+void bufferFree(w24Buffer *buffer);
+
+//Send or receive exactly length bytes. Both return 0 on success and -1 on error or disconnect.
+int sendAll(int socket, const void *data, size_t length);
+int recvAll(int socket, void *data, size_t length);
+
+//Send one length-prefixed chunk (length 0 marks the end of a stream).
+int sendChunk(int socket, const void *data, uint32_t length);
+
+//Command name for an opcode and back. Unknown values give NULL / -1.
+const char *opcodeCommand(int opcode);
+int commandOpcode(const char *command);
+
+void encodeHeader(const w24Header *header, unsigned char *buffer);
+//Returns -1 if the bytes do not start a version 1 frame.
+int decodeHeader(const unsigned char *buffer, w24Header *header);
+
+//Header and payload in one gathered send.
+int sendFrame(int socket, const w24Header *header, const void *payload);
+
+//Read one whole frame. The payload is malloc'd and NUL-terminated; the caller frees it.
+int recvFrame(int socket, w24Header *header, char **payload);
+
+//Server side replies: one complete text answer, or an archive as begin / data... / end.
+int sendReply(const w24Reply *reply, int status, const char *text, size_t length);
+//info may be NULL for an archive that cannot be fetched again.
+int sendArchiveBegin(const w24Reply *reply, const char *archiveName, const w24ArchiveInfo *info);
+int sendArchiveData(const w24Reply *reply, const void *data, size_t length);
+//Archive data taken straight from length bytes of fd at offset (sendfile, no user-space copy). The bytes are
+//framed like sendArchiveData's. sendfile raises SIGPIPE if the client is gone, so callers ignore it.
+int sendArchiveFile(const w24Reply *reply, int fd, off_t offset, size_t length);
+int sendArchiveEnd(const w24Reply *reply);
+
+//Client side: read the info after the file name in a first archive frame of length bytes. Missing fields
+//are left empty (no id, offset 0, size -1).
+void parseArchiveInfo(const char *payload, size_t length, w24ArchiveInfo *info);
+
+#endif
@@ -0,0 +1,2914 @@
+//Included all necessary libraries for project...
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <pthread.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include "w24proto.h"
+#include "w24archive.h"
+#include "w24index.h"
+#include "w24cache.h"
+#include "w24admit.h"
+#include "w24metrics.h"
+#include "w24server.h"
+#ifdef W24_USE_IO_URING
+#include "w24uring.h"
+#endif
+
+
+//Define maximum limits for directories, buffer sizes, and path lengths.
+
+#define MAX_BUFFER_SIZE 1024
+#define MAX_PATH_LEN 256
+
+//Each mirror listens for handed-off client sockets on a Unix-domain control socket named after its port.
+#define MIRROR_CTL_PATH_FMT "/tmp/w24mirror-%d.sock"
+#define MAX_BACKENDS 16
+#define MIRROR_RETRY_SEC 1
+#define MAX_CONTROLS 8
+
+//Load reports mirrors send back over the control socket.
+#define REPORT_REQUEST_START 1
+#define REPORT_REQUEST_DONE 2
+#define REPORT_CONNECTION_DONE 3
+
+//Dispatch policies for new connections and the weight of the newest sample in the service time average.
+#define DISPATCH_P2C 0
+#define DISPATCH_LEAST 1
+#define EWMA_WEIGHT 0.2
+
+//Tags for the objects registered with the reactor (the listening socket is registered as NULL).
+#define SOURCE_CLIENT 1
+#define SOURCE_BACKEND 2
+#define SOURCE_WAKEUP 3
+#define SOURCE_CONTROL_LISTENER 4
+#define SOURCE_CONTROL 5
+
+//Defaults for the epoll reactor and the worker thread pool that executes client commands.
+#define DEFAULT_WORKER_THREADS 4
+#define MAX_EVENTS 64
+
+#ifdef W24_USE_IO_URING
+//io_uring reactor (-DW24_USE_IO_URING): ring sizes, and the reply bytes one connection may have queued before
+//the workers writing to it wait.
+#define REACTOR_NAME "io_uring"
+#define RING_ENTRIES 4096
+#define RING_COMPLETIONS 16384
+#define OUTPUT_MAX_QUEUED (4 * 1024 * 1024)
+
+//What a ring completion is for, kept in the low bits of its user data next to the connection or backend.
+#define RING_TIMEOUT 0 // Admission queue timer
+#define RING_ACCEPT 1
+#define RING_WAKEUP 2
+#define RING_MIRROR 3
+#define RING_RECV 4
+#define RING_SEND 5
+#define RING_CANCEL 6
+#define RING_CONTROL 7 // Poll of a mirror's control connection from serverw24
+#define RING_TAG_MASK 7
+#else
+#define REACTOR_NAME "epoll"
+#endif
+
+//Binary requests one connection may have queued or running at once; reading pauses at the limit.
+#define MAX_PIPELINE 64
+
+//A pending unit of work for the thread pool.
+typedef struct poolJob {
+    void (*function)(void *arg);
+    void *arg;
+    struct poolJob *next;
+} poolJob;
+
+//Fixed-size pool of worker threads pulling jobs from a FIFO queue.
+typedef struct threadPool {
+    pthread_t *threads;
+    int numThreads;
+    poolJob *head;
+    poolJob *tail;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    int shutdown;
+} threadPool;
+
+#ifdef W24_USE_IO_URING
+//Reply bytes waiting for the ring to send them, oldest first.
+typedef struct outputChunk {
+    struct outputChunk *next;
+    size_t length;
+    size_t sent;
+    char data[];
+} outputChunk;
+#endif
+
+//On a mirror: a control connection from serverw24. Handed-off clients arrive on it and their load reports go
+//back over it. The reactor holds one reference while it watches the socket and every client handed off on it
+//holds another, so reports never reach a reused descriptor.
+typedef struct controlConn {
+    int source; // SOURCE_CONTROL
+    int fd;
+    pthread_mutex_t lock; // Guards refCount
+    int refCount;
+} controlConn;
+
+//How a connection talks to us, decided by its first bytes.
+#define CONN_MODE_UNKNOWN 0
+#define CONN_MODE_TEXT 1
+#define CONN_MODE_BINARY 2
+
+//State the reactor keeps for every client socket it owns.
+//Text connections run one request at a time with the socket disarmed. Binary connections stay armed and
+//may have up to MAX_PIPELINE requests in flight; the socket is closed when the last reference is released.
+typedef struct clientConn {
+    int source; // SOURCE_CLIENT
+    int fd;
+    int id;
+    int mode;     // CONN_MODE_*
+    char *inBuf;  // Received bytes not yet parsed into a request (reactor or the single text worker only)
+    size_t inLen;
+    size_t inCap;
+    pthread_mutex_t writeLock; // Keeps the frames of concurrent responses whole
+    pthread_mutex_t lock;      // Guards the fields below
+    int refCount;              // The reactor registration plus one per queued request or pending resume
+    int registered;            // Still in the epoll set
+    int inFlight;              // Binary requests queued or executing
+    int paused;                // Reading stopped at MAX_PIPELINE
+    int closing;               // quitc seen; no further requests are started
+    struct clientConn *resumeNext;
+    controlConn *control;      // On a mirror, the serverw24 connection that handed the client off, or NULL
+#ifdef W24_USE_IO_URING
+    int recvPending;            // A receive into inBuf is on the ring (reactor only)
+    w24Output output;           // Replies are queued here and sent by the ring, in order
+    outputChunk *outHead;       // The fields below are guarded by lock
+    outputChunk *outTail;
+    size_t outBytes;            // Queued and not sent yet
+    int sending;                // A send is on the ring
+    int claimed;                // A worker is writing the socket itself (sendfile)
+    int outputFailed;           // A send failed: the client is gone
+    pthread_cond_t outputSpace; // Signalled whenever queued bytes are sent
+#endif
+} clientConn;
+
+//A command parsed into arguments, ready for a worker thread.
+typedef struct clientRequest {
+    clientConn *conn;
+    w24Reply reply;
+    unsigned long long sent; // Bytes of the reply sent so far
+    char *buffer; // Argument text the argv entries point into
+    int argc;
+    const char *argv[]; // Sized for every token the payload can hold, so argument lists are not capped
+} clientRequest;
+
+//A node new connections can be routed to: serverw24 itself (backends[0]) or a mirror reached over its control socket.
+//Counters are protected by dispatchLock; the control socket is only touched by the reactor thread.
+typedef struct backend {
+    int source;                    // SOURCE_BACKEND
+    char name[32];
+    int port;
+    int controlSocket;             // -1 for serverw24 itself or a disconnected mirror
+    time_t retryAfter;             // Earliest time to reconnect a failed mirror
+    int connections;               // Live client connections on the node
+    int inFlight;                  // Requests queued or executing on the node
+    double ewmaServiceMs;          // Recent request service time
+    unsigned long routed;          // Connections routed to the node
+    unsigned long requests;        // Requests the node completed
+    unsigned long handoffFailures; // Handoffs that fell back to serverw24
+#ifdef W24_USE_IO_URING
+    int polled;                    // A poll on the control socket is on the ring
+#endif
+} backend;
+
+//Message a mirror sends over its control socket whenever its load changes.
+typedef struct mirrorReport {
+    int connectionId;
+    int event;              // REPORT_REQUEST_START, REPORT_REQUEST_DONE or REPORT_CONNECTION_DONE
+    unsigned int serviceUs; // Service time of a finished request
+} mirrorReport;
+
+#ifdef W24_USE_IO_URING
+static w24Ring ring;
+static int acceptMultishot = 1; // Cleared if the kernel predates multishot accept
+#else
+static int epollFd = -1;
+#endif
+static backend backends[MAX_BACKENDS];
+static int numBackends = 0;
+static int dispatchPolicy = DISPATCH_P2C;
+static pthread_mutex_t dispatchLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The node this process runs as (serverw24 or a mirror), from its main.
+static serverConfig node;
+
+//On a mirror: the Unix-domain socket serverw24 connects to in order to hand clients off.
+static int controlListener = -1;
+//Names the control listener in epoll events, or in the ring's user data under a tag in the low bits, which
+//needs the address aligned past them.
+static int controlListenerSource __attribute__((aligned(8))) = SOURCE_CONTROL_LISTENER;
+
+//Metadata of everything in HOME; the commands query it instead of scanning the directory.
+static w24Index homeIndex;
+
+//Compressed archives already sent, by codec and file set fingerprint (-C, -M; off with -M 0).
+static w24Cache resultCache;
+static int cacheEnabled = 0;
+
+//Compressed per-file members shared by all archives (-K; off with -K 0).
+static blockCache memberBlocks;
+static int blocksEnabled = 0;
+
+//Connections served at once and waiting for a slot (-a, -q, -T; off without -a).
+static w24Admission admission;
+static int admissionEnabled = 0;
+
+//Request counters and latency histograms in the node's shared memory segment (w24metrics, -m).
+static w24Metrics *metrics;
+static int metricsListener = -1;
+
+//The file lists and settings of the last RECENT_RESULTS archives, by result id, so w24get can produce an
+//archive again once the result cache no longer holds it.
+#define RECENT_RESULTS 64
+
+typedef struct recentResult {
+    char id[CACHE_KEY_LEN + 1];
+    archiveList members;
+    archiveOptions options;
+} recentResult;
+
+static recentResult recentResults[RECENT_RESULTS];
+static int nextRecentResult = 0;
+static pthread_mutex_t recentLock = PTHREAD_MUTEX_INITIALIZER;
+
+//Workers hand paused connections back to the reactor through this list and an eventfd.
+static int wakeupFd = -1;
+#ifndef W24_USE_IO_URING
+static int wakeupSource = SOURCE_WAKEUP;
+#endif
+static clientConn *resumeList = NULL;
+static pthread_mutex_t resumeLock = PTHREAD_MUTEX_INITIALIZER;
+
+//Worker loop: wait for a job, run it, repeat until the pool is shut down.
+static void *workerThread(void *arg) {
+    threadPool *pool = (threadPool *)arg;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL && !pool->shutdown) {
+            pthread_cond_wait(&pool->notEmpty, &pool->lock);
+        }
+        if (pool->shutdown && pool->head == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        poolJob *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        job->function(job->arg);
+        free(job);
+    }
+
+    return NULL;
+}
+
+//Start numThreads workers. Returns -1 if no thread could be created.
+int threadPoolInit(threadPool *pool, int numThreads) {
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->shutdown = 0;
+    pool->numThreads = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->notEmpty, NULL);
+
+    pool->threads = malloc(sizeof(pthread_t) * numThreads);
+    if (!pool->threads) {
+        return -1;
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, workerThread, pool) != 0) {
+            perror("Worker thread creation failed");
+            break;
+        }
+        pool->numThreads++;
+    }
+
+    return pool->numThreads > 0 ? 0 : -1;
+}
+
+//Queue a job for the next free worker.
+int threadPoolSubmit(threadPool *pool, void (*function)(void *), void *arg) {
+    poolJob *job = malloc(sizeof(poolJob));
+    if (!job) {
+        return -1;
+    }
+    job->function = function;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pthread_cond_signal(&pool->notEmpty);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+//Let the workers drain the queue, then join them.
+void threadPoolDestroy(threadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->notEmpty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->numThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->notEmpty);
+}
+
+//Switch a socket to non-blocking mode (required for the edge-triggered reactor).
+int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+double monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+backend *addBackend(const char *name, int port) {
+    if (numBackends == MAX_BACKENDS) {
+        fprintf(stderr, "Too many backends, ignoring %s\n", name);
+        return NULL;
+    }
+    backend *b = &backends[numBackends++];
+    memset(b, 0, sizeof(*b));
+    b->source = SOURCE_BACKEND;
+    snprintf(b->name, sizeof(b->name), "%s", name);
+    b->port = port;
+    b->controlSocket = -1;
+    return b;
+}
+
+//Set up the backend table: this node itself, then on serverw24 every mirror from the config file ("name port"
+//per line, '#' starts a comment). Without a config file the two standard mirrors are used. A mirror serves
+//every client itself.
+int loadBackends(const char *configPath, int port) {
+    addBackend(node.name, port);
+
+    if (node.role == SERVER_ROLE_MIRROR) {
+        return 0;
+    }
+    if (configPath == NULL) {
+        addBackend("mirror1", MIRROR1_PORT);
+        addBackend("mirror2", MIRROR2_PORT);
+        return 0;
+    }
+
+    FILE *config = fopen(configPath, "r");
+    if (!config) {
+        perror("Failed to open mirror config");
+        return -1;
+    }
+
+    char line[MAX_BUFFER_SIZE];
+    while (fgets(line, sizeof(line), config) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char name[32];
+        int mirrorPort;
+        if (sscanf(line, "%31s %d", name, &mirrorPort) == 2) {
+            addBackend(name, mirrorPort);
+        }
+    }
+
+    fclose(config);
+    return 0;
+}
+
+#ifdef W24_USE_IO_URING
+//Queue a one-shot poll for the mirror's load reports; the reactor queues the next one after reading them.
+//Reactor only, like the control socket itself.
+void pollMirror(backend *b) {
+    if (b->polled) {
+        return; // The poll of a previous connection has not completed yet; its completion polls this one
+    }
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepPoll(sqe, b->controlSocket, POLLIN, (uintptr_t)b | RING_MIRROR);
+        ringPublish(&ring);
+        b->polled = 1;
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+#endif
+
+//Mirrors are reached over a Unix-domain control socket; the accepted client descriptor itself is passed with SCM_RIGHTS.
+//SOCK_SEQPACKET keeps every handoff and every load report a separate message. The socket is also registered with
+//the reactor so load reports are read as they arrive.
+int mirrorControlSocket(backend *b) {
+    if (b->controlSocket != -1) {
+        return b->controlSocket;
+    }
+    if (time(NULL) < b->retryAfter) {
+        return -1;
+    }
+
+    struct sockaddr_un ctlAddr;
+    memset(&ctlAddr, 0, sizeof(ctlAddr));
+    ctlAddr.sun_family = AF_UNIX;
+    snprintf(ctlAddr.sun_path, sizeof(ctlAddr.sun_path), MIRROR_CTL_PATH_FMT, b->port);
+
+    int mirrorSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (mirrorSocket == -1) {
+        perror("Mirror socket creation failed");
+        return -1;
+    }
+
+    if (connect(mirrorSocket, (struct sockaddr *)&ctlAddr, sizeof(ctlAddr)) == -1 || setNonBlocking(mirrorSocket) == -1) {
+        close(mirrorSocket);
+        b->retryAfter = time(NULL) + MIRROR_RETRY_SEC;
+        return -1;
+    }
+
+#ifndef W24_USE_IO_URING
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = b;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, mirrorSocket, &ev) == -1) {
+        perror("epoll_ctl add failed");
+        close(mirrorSocket);
+        return -1;
+    }
+#endif
+
+    printf("Connected to %s control socket %s\n", b->name, ctlAddr.sun_path);
+    b->controlSocket = mirrorSocket;
+#ifdef W24_USE_IO_URING
+    pollMirror(b);
+#endif
+    return mirrorSocket;
+}
+
+//Forget a mirror whose control connection broke; its clients went with it.
+void mirrorDisconnected(backend *b) {
+    printf("Lost control connection to %s\n", b->name);
+#ifdef W24_USE_IO_URING
+    if (b->polled) {
+        // A queued poll keeps the socket open past close(); cancel it so the mirror sees the disconnect
+        pthread_mutex_lock(&ring.lock);
+        struct io_uring_sqe *sqe = ringGetSqe(&ring);
+        if (sqe) {
+            ringPrepCancel(sqe, (uintptr_t)b | RING_MIRROR, RING_CANCEL);
+            ringPublish(&ring);
+        }
+        pthread_mutex_unlock(&ring.lock);
+    }
+#endif
+    close(b->controlSocket);
+    b->controlSocket = -1;
+    b->retryAfter = time(NULL) + MIRROR_RETRY_SEC;
+
+    pthread_mutex_lock(&dispatchLock);
+    b->connections = 0;
+    b->inFlight = 0;
+    pthread_mutex_unlock(&dispatchLock);
+}
+
+void recordRequestStart(backend *b) {
+    pthread_mutex_lock(&dispatchLock);
+    b->inFlight++;
+    pthread_mutex_unlock(&dispatchLock);
+}
+
+void recordRequestDone(backend *b, double serviceMs) {
+    pthread_mutex_lock(&dispatchLock);
+    if (b->inFlight > 0) {
+        b->inFlight--;
+    }
+    b->requests++;
+    if (b->requests == 1) {
+        b->ewmaServiceMs = serviceMs;
+    } else {
+        b->ewmaServiceMs = EWMA_WEIGHT * serviceMs + (1 - EWMA_WEIGHT) * b->ewmaServiceMs;
+    }
+    pthread_mutex_unlock(&dispatchLock);
+}
+
+void recordConnectionDone(backend *b) {
+    pthread_mutex_lock(&dispatchLock);
+    if (b->connections > 0) {
+        b->connections--;
+    }
+    pthread_mutex_unlock(&dispatchLock);
+}
+
+//Read every load report a mirror has queued on its control socket.
+void readMirrorReports(backend *b) {
+    mirrorReport report;
+
+    while (1) {
+        ssize_t bytesRead = recv(b->controlSocket, &report, sizeof(report), 0);
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (bytesRead <= 0) {
+            mirrorDisconnected(b);
+            return;
+        }
+        if (bytesRead != sizeof(report)) {
+            continue;
+        }
+
+        if (report.event == REPORT_REQUEST_START) {
+            recordRequestStart(b);
+        } else if (report.event == REPORT_REQUEST_DONE) {
+            recordRequestDone(b, report.serviceUs / 1000.0);
+        } else if (report.event == REPORT_CONNECTION_DONE) {
+            recordConnectionDone(b);
+        }
+    }
+}
+
+//Expected time to drain a node if one more request lands on it; live connections break ties between idle nodes.
+double backendLoad(const backend *b) {
+    return (b->inFlight + 1) * (b->ewmaServiceMs + 1.0) + b->connections;
+}
+
+//Pick the node for a new connection: the least loaded one, or the better of two random candidates (power of
+//two choices). serverw24 is always a candidate; mirrors only while their control socket is up.
+backend *chooseBackend(void) {
+    static unsigned int seed = 24;
+    backend *candidates[MAX_BACKENDS];
+    int numCandidates = 0;
+
+    candidates[numCandidates++] = &backends[0];
+    for (int i = 1; i < numBackends; i++) {
+        if (mirrorControlSocket(&backends[i]) != -1) {
+            candidates[numCandidates++] = &backends[i];
+        }
+    }
+
+    backend *chosen = candidates[0];
+    pthread_mutex_lock(&dispatchLock);
+    if (dispatchPolicy == DISPATCH_LEAST || numCandidates <= 2) {
+        for (int i = 1; i < numCandidates; i++) {
+            if (backendLoad(candidates[i]) < backendLoad(chosen)) {
+                chosen = candidates[i];
+            }
+        }
+    } else {
+        int first = rand_r(&seed) % numCandidates;
+        int second = rand_r(&seed) % (numCandidates - 1);
+        if (second >= first) {
+            second++;
+        }
+        chosen = candidates[first];
+        if (backendLoad(candidates[second]) < backendLoad(chosen)) {
+            chosen = candidates[second];
+        }
+    }
+    chosen->routed++;
+    chosen->connections++;
+    pthread_mutex_unlock(&dispatchLock);
+
+    return chosen;
+}
+
+//Pass the client socket to a mirror process with SCM_RIGHTS.
+//Returns 0 once the mirror owns a duplicate of the descriptor; the caller closes its copy either way.
+int forwardToMirror(int clientSocket, backend *mirror, int connectionId) {
+    int mirrorSocket = mirrorControlSocket(mirror);
+    if (mirrorSocket == -1) {
+        return -1;
+    }
+
+    // The payload carries the connection number; the descriptor travels in the control message
+    struct iovec iov = { .iov_base = &connectionId, .iov_len = sizeof(connectionId) };
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &clientSocket, sizeof(int));
+
+    // Never block the reactor on a stalled mirror
+    while (sendmsg(mirrorSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("Error sending client socket to mirror");
+            mirrorDisconnected(mirror);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+//Drop one reference to a control connection from serverw24; the last one closes it.
+void releaseControl(controlConn *control) {
+    pthread_mutex_lock(&control->lock);
+    int last = (--control->refCount == 0);
+    pthread_mutex_unlock(&control->lock);
+    if (!last) {
+        return;
+    }
+    close(control->fd);
+    pthread_mutex_destroy(&control->lock);
+    free(control);
+}
+
+//On a mirror, tell serverw24 how the load of a client it handed off changed. Clients that connected
+//directly have no control connection and are not reported. Workers never wait for serverw24 to drain the
+//socket: when it is full the report is dropped, since dispatch only needs an approximate load.
+void reportLoad(controlConn *control, int connectionId, int event, unsigned int serviceUs) {
+    if (control == NULL) {
+        return;
+    }
+    mirrorReport report = { connectionId, event, serviceUs };
+    send(control->fd, &report, sizeof(report), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+//A request of the client started or finished on this node.
+void requestStarted(clientConn *conn) {
+    recordRequestStart(&backends[0]);
+    reportLoad(conn->control, conn->id, REPORT_REQUEST_START, 0);
+}
+
+void requestFinished(clientRequest *request, double serviceMs) {
+    clientConn *conn = request->conn;
+    recordRequestDone(&backends[0], serviceMs);
+    reportLoad(conn->control, conn->id, REPORT_REQUEST_DONE, (unsigned int)(serviceMs * 1000));
+    metricsRequest(metrics, request->reply.opcode, (uint64_t)(serviceMs * 1000), request->sent);
+}
+
+//The client's connection ended; a handed-off client also lets go of its control connection.
+void connectionFinished(int connectionId, controlConn *control) {
+    recordConnectionDone(&backends[0]);
+    if (control != NULL) {
+        reportLoad(control, connectionId, REPORT_CONNECTION_DONE, 0);
+        releaseControl(control);
+    }
+}
+
+//Send a complete text answer to the request being served.
+void sendResponse(w24Reply *reply, const char *response) {
+    sendReply(reply, STATUS_OK, response, strlen(response));
+}
+
+//Same for failures; binary clients also receive the status code.
+void sendError(w24Reply *reply, int status, const char *message) {
+    sendReply(reply, status, message, strlen(message));
+}
+
+
+//dirlist -a / -t [offset [limit]]: the directories in HOME (or its whole tree) sorted by name or creation
+//time, straight from the index. The names are copied once into a single reply buffer, so listings of any
+//size cost O(n); offset and limit page through them.
+void listDirectories(w24Reply *reply, const char *option, int recursive, size_t offset, size_t limit) {
+    w24Buffer result;
+    bufferInit(&result);
+    if (indexDirectories(&homeIndex, strcmp(option, "-t") == 0, recursive, offset, limit, &result) == -1) {
+        bufferFree(&result);
+        sendError(reply, STATUS_ERROR, "Failed to list home directory");
+        return;
+    }
+
+    sendReply(reply, STATUS_OK, result.data ? result.data : "", result.length);
+    bufferFree(&result);
+}
+
+//Parse a non-negative count argument. Returns -1 if it is not one.
+int parseCount(const char *text, size_t *count) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (text[0] == '-' || end == text || *end != '\0' || errno == ERANGE) {
+        return -1;
+    }
+    *count = value;
+    return 0;
+}
+
+
+
+void getFileDetails(w24Reply *reply, const char *filename, int recursive) {
+    // Look the file up in the index instead of calling stat
+    w24IndexEntry fileInfo;
+    if (!indexLookup(&homeIndex, filename, recursive, &fileInfo)) {
+        sendError(reply, STATUS_NOT_FOUND, "File not found");
+        return;
+    }
+
+    // Format file details into a string including name, size, permissions, and creation date
+    char details[MAX_BUFFER_SIZE + PATH_MAX];
+    char dateCreated[64];
+    time_t btime = fileInfo.btime;
+    snprintf(details, sizeof(details), "Name: %s\nSize: %lld bytes\nPermissions: %o\nDate Created: %s",
+             fileInfo.path, (long long)fileInfo.size, fileInfo.mode & 0777, ctime_r(&btime, dateCreated));
+
+    sendResponse(reply, details);
+}
+
+
+//Remember how to produce the archive with this result id again. Allocation failures only lose the entry.
+void rememberResult(const char *id, const archiveList *matches, const archiveOptions *options) {
+    pthread_mutex_lock(&recentLock);
+    for (int i = 0; i < RECENT_RESULTS; i++) {
+        if (strcmp(recentResults[i].id, id) == 0) {
+            pthread_mutex_unlock(&recentLock);
+            return;
+        }
+    }
+
+    recentResult *result = &recentResults[nextRecentResult];
+    nextRecentResult = (nextRecentResult + 1) % RECENT_RESULTS;
+    archiveListFree(&result->members);
+    result->id[0] = '\0';
+    if (archiveListCopy(&result->members, matches) == 0) {
+        snprintf(result->id, sizeof(result->id), "%s", id);
+        archiveOptionsInit(&result->options);
+        result->options.threads = options->threads;
+        result->options.codec = options->codec;
+        result->options.level = options->level;
+        result->options.blocks = options->blocks; // Whether it was assembled from members is part of its id
+    }
+    pthread_mutex_unlock(&recentLock);
+}
+
+//Copy out the file list and settings of a remembered result. Returns -1 if it is not remembered.
+int findResult(const char *id, archiveList *members, archiveOptions *options) {
+    int found = -1;
+    pthread_mutex_lock(&recentLock);
+    for (int i = 0; i < RECENT_RESULTS; i++) {
+        if (strcmp(recentResults[i].id, id) == 0) {
+            found = archiveListCopy(members, &recentResults[i].members);
+            *options = recentResults[i].options;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&recentLock);
+    return found;
+}
+
+//Stream the archive with result id id, or the range of it the options ask for, through the result cache:
+//a hit is sent from disk, a miss is compressed as usual while a copy is written to the cache. The copy is
+//finished even if the client leaves, so it can resume from the cache. Uncompressed archives are already
+//sent with sendfile and are never cached.
+void sendArchiveResult(w24Reply *reply, const archiveList *members, const char *id, const archiveOptions *options) {
+    archiveOptions resultOptions = *options;
+    resultOptions.resultId = id;
+    if (!cacheEnabled || options->codec == ARCHIVE_CODEC_NONE) {
+        streamArchive(reply, homeIndex.rootDir, members, "temp", &resultOptions);
+        return;
+    }
+
+    if (cacheServe(&resultCache, reply, id, "temp", options->rangeOffset, options->rangeLength) != 0) {
+        return;
+    }
+
+    archiveTee tee;
+    int storing = cacheBegin(&resultCache, &tee) == 0;
+    resultOptions.tee = storing ? &tee : NULL;
+    streamArchive(reply, homeIndex.rootDir, members, "temp", &resultOptions);
+    if (storing) {
+        cacheFinish(&resultCache, id, &tee);
+    }
+}
+
+//Stream the selected files from HOME, or report that nothing matched. Members go in name order, so the
+//archive's bytes depend only on the files, and its id (the cache key) names exactly those bytes.
+void sendMatches(w24Reply *reply, archiveList *matches, const archiveOptions *options, const char *emptyMessage) {
+    if (matches->count > 0) {
+        char id[CACHE_KEY_LEN + 1];
+        archiveListSort(matches);
+        cacheKey(homeIndex.rootDir, matches, options, id);
+        rememberResult(id, matches, options);
+
+        // What the members came to in the archive, for the compression ratio
+        archiveOptions countedOptions = *options;
+        unsigned long long inputBytes = 0;
+        unsigned long long sentBefore = reply->sent ? *reply->sent : 0;
+        countedOptions.inputBytes = &inputBytes;
+        sendArchiveResult(reply, matches, id, &countedOptions);
+        metricsArchive(metrics, matches->count, inputBytes, reply->sent ? *reply->sent - sentBefore : 0);
+    } else {
+        sendError(reply, STATUS_NOT_FOUND, emptyMessage);
+    }
+    archiveListFree(matches);
+}
+
+//w24get <result id> [offset [length]]: an archive sent earlier, or length bytes of it from offset, so a
+//client can resume an interrupted download or fetch ranges in parallel. It comes from the result cache, or
+//is produced again from the remembered file list as long as none of the files changed.
+void sendResultRange(w24Reply *reply, const char *id, unsigned long long offset, unsigned long long length) {
+    archiveList members;
+    archiveOptions options;
+    if (findResult(id, &members, &options) == -1) {
+        // Not remembered (e.g. from before a restart), but its archive may still be cached
+        if (!cacheEnabled || cacheServe(&resultCache, reply, id, "temp", offset, length) == 0) {
+            sendError(reply, STATUS_NOT_FOUND, "Result not found, run the query again");
+        }
+        return;
+    }
+
+    char key[CACHE_KEY_LEN + 1];
+    cacheKey(homeIndex.rootDir, &members, &options, key);
+    if (strcmp(key, id) != 0) {
+        sendError(reply, STATUS_NOT_FOUND, "Files changed since, run the query again");
+    } else {
+        options.rangeOffset = offset;
+        options.rangeLength = length;
+        sendArchiveResult(reply, &members, id, &options);
+    }
+    archiveListFree(&members);
+}
+
+// Stream an archive of files from the HOME directory whose size lies within [minSize, maxSize]
+void sendFilesBySizeRange(w24Reply *reply, long long minSize, long long maxSize, int recursive,
+                          const archiveOptions *options) {
+    archiveList matches;
+    archiveListInit(&matches);
+
+    indexSelectSizeRange(&homeIndex, minSize, maxSize, recursive, &matches);
+    sendMatches(reply, &matches, options, "No files found within the specified size range");
+}
+
+// Stream an archive containing files from the HOME directory that match specified extensions
+void sendFilesByExtensions(w24Reply *reply, const char **extensions, int numExtensions, int recursive,
+                           const archiveOptions *options) {
+    archiveList matches;
+    archiveListInit(&matches);
+
+    indexSelectExtensions(&homeIndex, extensions, numExtensions, recursive, &matches);
+    sendMatches(reply, &matches, options, "No files found matching specified extensions");
+}
+
+// Stream an archive of the files in HOME created on/before (beforeOrEqual) or on/after targetDate
+void createArchiveFilteredByDate(w24Reply *reply, time_t targetDate, int beforeOrEqual, int recursive,
+                                 const archiveOptions *options) {
+    archiveList matches;
+    archiveListInit(&matches);
+
+    indexSelectCreationTime(&homeIndex, targetDate, beforeOrEqual, recursive, &matches);
+    sendMatches(reply, &matches, options, "No files found");
+}
+
+
+
+// Function to stream an archive containing files modified before a specified date
+// - date: Date string in the format "YYYY-MM-DD" to specify the target date
+void sendFilesByDateBefore(w24Reply *reply, const char *date, int recursive, const archiveOptions *options) {
+    // Convert date string to time_t
+    struct tm tm = {0};
+    strptime(date, "%Y-%m-%d", &tm);
+    time_t targetDate = mktime(&tm);
+
+    // Stream an archive containing files modified before the target date
+    createArchiveFilteredByDate(reply, targetDate, 1, recursive, options);
+}
+
+// Function to stream an archive containing files modified after a specified date
+// - date: Date string in the format "YYYY-MM-DD" to specify the target date
+void sendFilesByDateAfter(w24Reply *reply, const char *date, int recursive, const archiveOptions *options) {
+    // Convert date string to time_t
+    struct tm tm = {0};
+    strptime(date, "%Y-%m-%d", &tm);
+    time_t targetDate = mktime(&tm);
+
+    // Stream an archive containing files modified after the target date
+    createArchiveFilteredByDate(reply, targetDate, 0, recursive, options);
+}
+
+//Reads and counts everything the benchmark archive sends, standing in for the client.
+void *drainSocket(void *arg) {
+    int fd = *(int *)arg;
+    static char buffer[256 * 1024];
+    long long total = 0;
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        total += length;
+    }
+    return (void *)(intptr_t)total;
+}
+
+//Index rootDir and select every file under it, as w24fz -r over the whole size range would. Reading the
+//files once puts them in the page cache, so the archive benchmarks measure compression. Returns their bytes.
+long long selectBenchmarkFiles(const char *rootDir, archiveList *matches) {
+    archiveListInit(matches);
+    if (indexInit(&homeIndex, rootDir, 0) == -1) {
+        return 0;
+    }
+    indexSelectSizeRange(&homeIndex, 0, LLONG_MAX, 1, matches);
+
+    long long inputBytes = 0;
+    char buffer[65536];
+    for (int i = 0; i < matches->count; i++) {
+        char filePath[PATH_MAX * 2];
+        snprintf(filePath, sizeof(filePath), "%s/%s", rootDir, matches->members[i].name);
+        int fd = open(filePath, O_RDONLY);
+        ssize_t length;
+        while (fd != -1 && (length = read(fd, buffer, sizeof(buffer))) > 0) {
+            inputBytes += length;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    return inputBytes;
+}
+
+//CPU time of the calling thread, user and system, in ms.
+double threadCpuMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+//Stream one archive of the files into a local socket. Returns the ms it took and sets *sent to the bytes the
+//client side received and *cpuMs to the CPU the streaming thread used, or returns -1.
+double timeArchive(const char *rootDir, const archiveList *matches, const archiveOptions *options, long long *sent,
+                   double *cpuMs) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+        perror("socketpair failed");
+        return -1;
+    }
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, drainSocket, &sockets[1]);
+
+    w24Reply reply = { sockets[0], 1, 1, OP_W24FZ, NULL, NULL };
+    double start = monotonicMs();
+    double cpuStart = threadCpuMs();
+    streamArchive(&reply, rootDir, matches, "bench", options);
+    double ms = monotonicMs() - start;
+    *cpuMs = threadCpuMs() - cpuStart;
+    close(sockets[0]);
+    void *received;
+    pthread_join(drainer, &received);
+    close(sockets[1]);
+
+    *sent = (intptr_t)received;
+    return ms;
+}
+
+//-b gzip: stream every file under HOME through the w24fz path (the whole size range, recursive) with 1, 2,
+//4... compression threads, up to one per CPU (at least 8), and print the input MB/s and compression ratio.
+void archiveGzipBenchmark(const char *rootDir) {
+    archiveList matches;
+    long long inputBytes = selectBenchmarkFiles(rootDir, &matches);
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cpus > 8 ? cpus : 8;
+    printf("Archive of %s: %d files, %.1f MB, %d CPUs\n", rootDir, matches.count, inputBytes / 1e6, cpus);
+    printf("%8s %10s %10s %9s %8s\n", "threads", "ms", "MB/s", "speedup", "ratio");
+
+    double singleMs = 0;
+    for (int threads = 1;; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+        archiveOptions options;
+        archiveOptionsInit(&options);
+        options.threads = threads;
+        long long sent;
+        double cpuMs;
+        double ms = timeArchive(rootDir, &matches, &options, &sent, &cpuMs);
+        if (ms < 0) {
+            break;
+        }
+
+        if (threads == 1) {
+            singleMs = ms;
+        }
+        printf("%8d %10.1f %10.1f %8.2fx %8.3f\n", threads, ms, inputBytes / 1e3 / ms, singleMs / ms,
+               inputBytes ? (double)sent / inputBytes : 0);
+        if (threads >= maxThreads) {
+            break;
+        }
+    }
+    archiveListFree(&matches);
+    indexFree(&homeIndex);
+}
+
+//-b codec: the same archive with each codec at a fast, the default and a strong level, on one thread. The
+//CPU column is the streaming thread's; with none it is mostly the kernel copying pages to the socket.
+void archiveCodecBenchmark(const char *rootDir) {
+    static const struct { int codec; int level; } runs[] = {
+        { ARCHIVE_CODEC_NONE, ARCHIVE_LEVEL_DEFAULT },
+        { ARCHIVE_CODEC_GZIP, 1 }, { ARCHIVE_CODEC_GZIP, ARCHIVE_LEVEL_DEFAULT }, { ARCHIVE_CODEC_GZIP, 9 },
+        { ARCHIVE_CODEC_ZSTD, 1 }, { ARCHIVE_CODEC_ZSTD, ARCHIVE_LEVEL_DEFAULT }, { ARCHIVE_CODEC_ZSTD, 19 },
+        { ARCHIVE_CODEC_LZ4, 1 }, { ARCHIVE_CODEC_LZ4, 9 },
+    };
+
+    archiveList matches;
+    long long inputBytes = selectBenchmarkFiles(rootDir, &matches);
+    printf("Archive of %s: %d files, %.1f MB\n", rootDir, matches.count, inputBytes / 1e6);
+    printf("%-12s %10s %10s %10s %8s\n", "codec", "ms", "cpu ms", "MB/s", "ratio");
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        char label[32];
+        if (runs[i].level == ARCHIVE_LEVEL_DEFAULT) {
+            snprintf(label, sizeof(label), "%s", archiveCodecName(runs[i].codec));
+        } else {
+            snprintf(label, sizeof(label), "%s:%d", archiveCodecName(runs[i].codec), runs[i].level);
+        }
+        if (!archiveCodecSupported(runs[i].codec)) {
+            printf("%-12s %10s\n", label, "unsupported");
+            continue;
+        }
+
+        archiveOptions options;
+        archiveOptionsInit(&options);
+        options.codec = runs[i].codec;
+        options.level = runs[i].level;
+        long long sent;
+        double cpuMs;
+        double ms = timeArchive(rootDir, &matches, &options, &sent, &cpuMs);
+        if (ms < 0) {
+            break;
+        }
+        printf("%-12s %10.1f %10.1f %10.1f %8.3f\n", label, ms, cpuMs, inputBytes / 1e3 / ms,
+               inputBytes ? (double)sent / inputBytes : 0);
+    }
+    archiveListFree(&matches);
+    indexFree(&homeIndex);
+}
+
+//-b blocks: CPU for overlapping archives. Two halves of the files under HOME that share a third of their
+//members are archived as one gzip stream, then from per-file blocks with a cold cache, then again warm.
+void archiveBlocksBenchmark(const char *rootDir) {
+    archiveList all, first, second;
+    long long inputBytes = selectBenchmarkFiles(rootDir, &all);
+    archiveListInit(&first);
+    archiveListInit(&second);
+    for (int i = 0; i < all.count; i++) {
+        // first gets files 0..2/3, second 1/3..end
+        if (i < all.count * 2 / 3) {
+            archiveListAdd(&first, all.members[i].name);
+        }
+        if (i >= all.count / 3) {
+            archiveListAdd(&second, all.members[i].name);
+        }
+    }
+    printf("Archive of %s: %d files, %.1f MB; two queries of %d and %d files\n", rootDir, all.count,
+           inputBytes / 1e6, first.count, second.count);
+    printf("%-28s %10s %10s %8s\n", "mode", "ms", "cpu ms", "ratio");
+
+    blockCache blocks;
+    blockCacheInit(&blocks, (size_t)DEFAULT_BLOCK_CACHE_MB * 1024 * 1024);
+    const char *labels[3] = { "one gzip stream", "blocks, cold cache", "blocks, warm cache" };
+    for (int run = 0; run < 3; run++) {
+        archiveOptions options;
+        archiveOptionsInit(&options);
+        options.blocks = run > 0 ? &blocks : NULL;
+        double ms = 0, cpuMs = 0;
+        long long sent = 0;
+        for (int query = 0; query < 2; query++) {
+            long long querySent;
+            double queryCpuMs;
+            ms += timeArchive(rootDir, query == 0 ? &first : &second, &options, &querySent, &queryCpuMs);
+            cpuMs += queryCpuMs;
+            sent += querySent;
+        }
+        long long queryBytes = inputBytes * (first.count + second.count) / (all.count ? all.count : 1);
+        printf("%-28s %10.1f %10.1f %8.3f\n", labels[run], ms, cpuMs, queryBytes ? (double)sent / queryBytes : 0);
+    }
+    blockCacheFree(&blocks);
+    archiveListFree(&first);
+    archiveListFree(&second);
+    archiveListFree(&all);
+    indexFree(&homeIndex);
+}
+
+//Evict the files from the page cache, so the next archive reads them from disk.
+void evictBenchmarkFiles(const char *rootDir, const archiveList *matches) {
+    for (int i = 0; i < matches->count; i++) {
+        char filePath[PATH_MAX * 2];
+        snprintf(filePath, sizeof(filePath), "%s/%s", rootDir, matches->members[i].name);
+        int fd = open(filePath, O_RDONLY);
+        if (fd != -1) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+//-b pipeline: cold-cache archives of every file under HOME from per-file members: one file at a time as
+//before the pipeline, with the next files read ahead, and read ahead with compression workers too.
+void archivePipelineBenchmark(const char *rootDir) {
+    archiveList matches;
+    long long inputBytes = selectBenchmarkFiles(rootDir, &matches);
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 4 ? cpus : 4;
+    printf("Cold archive of %s: %d files, %.1f MB, %d CPUs\n", rootDir, matches.count, inputBytes / 1e6, cpus);
+    printf("%-28s %10s %10s %9s\n", "mode", "ms", "MB/s", "speedup");
+
+    const struct { const char *label; int prefetch; int threads; } runs[] = {
+        { "sequential", 0, 1 }, { "read ahead", 1, 1 }, { "read ahead + workers", 1, workers },
+    };
+    double sequentialMs = 0;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        blockCache blocks;
+        blockCacheInit(&blocks, (size_t)DEFAULT_BLOCK_CACHE_MB * 1024 * 1024);
+        archiveOptions options;
+        archiveOptionsInit(&options);
+        options.blocks = &blocks;
+        options.prefetch = runs[i].prefetch;
+        options.threads = runs[i].threads;
+
+        evictBenchmarkFiles(rootDir, &matches);
+        long long sent;
+        double cpuMs;
+        double ms = timeArchive(rootDir, &matches, &options, &sent, &cpuMs);
+        blockCacheFree(&blocks);
+        if (ms < 0) {
+            break;
+        }
+        if (i == 0) {
+            sequentialMs = ms;
+        }
+        char label[64];
+        snprintf(label, sizeof(label), runs[i].threads > 1 ? "%s (%d)" : "%s", runs[i].label, runs[i].threads);
+        printf("%-28s %10.1f %10.1f %8.2fx\n", label, ms, inputBytes / 1e3 / ms, sequentialMs / ms);
+    }
+    archiveListFree(&matches);
+    indexFree(&homeIndex);
+}
+
+//Make the reactor look at the resume list and the admission queue.
+void wakeReactor(void) {
+    uint64_t one = 1;
+    if (write(wakeupFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror("Failed to wake the reactor");
+    }
+}
+
+//Drop one reference; the last one closes the socket and gives its slot to the next waiting connection.
+void releaseClient(clientConn *conn) {
+    pthread_mutex_lock(&conn->lock);
+    int last = (--conn->refCount == 0);
+    pthread_mutex_unlock(&conn->lock);
+    if (!last) {
+        return;
+    }
+
+    printf("Connection %d: Client disconnected\n", conn->id);
+    close(conn->fd);
+#ifdef W24_USE_IO_URING
+    while (conn->outHead != NULL) {
+        outputChunk *next = conn->outHead->next;
+        free(conn->outHead);
+        conn->outHead = next;
+    }
+    pthread_cond_destroy(&conn->outputSpace);
+#endif
+    pthread_mutex_destroy(&conn->writeLock);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn->inBuf);
+    int id = conn->id;
+    controlConn *control = conn->control;
+    free(conn);
+    metricsConnection(metrics, 0);
+    connectionFinished(id, control);
+    if (admissionEnabled && admissionLeave(&admission)) {
+        wakeReactor(); // Only the reactor registers connections
+    }
+}
+
+//Stop watching the client. Requests still in flight keep the connection alive until they finish.
+void closeClient(clientConn *conn) {
+    pthread_mutex_lock(&conn->lock);
+    int registered = conn->registered;
+    conn->registered = 0;
+    conn->closing = 1;
+    pthread_mutex_unlock(&conn->lock);
+    if (!registered) {
+        return;
+    }
+
+#ifndef W24_USE_IO_URING
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+#endif
+    releaseClient(conn);
+}
+
+//Hand a paused connection back to the reactor; the caller holds a reference for the list.
+void queueResume(clientConn *conn) {
+    pthread_mutex_lock(&resumeLock);
+    conn->resumeNext = resumeList;
+    resumeList = conn;
+    pthread_mutex_unlock(&resumeLock);
+    wakeReactor();
+}
+
+#ifdef W24_USE_IO_URING
+//Hand the socket back to the reactor so the next command on it is picked up. Only the reactor queues
+//receives, so it is woken like for a paused pipeline.
+void rearmClient(clientConn *conn) {
+    pthread_mutex_lock(&conn->lock);
+    conn->refCount++;
+    pthread_mutex_unlock(&conn->lock);
+    queueResume(conn);
+}
+#else
+//Hand the socket back to the reactor so the next command on it is picked up.
+void rearmClient(clientConn *conn) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev) == -1) {
+        perror("epoll_ctl rearm failed");
+        closeClient(conn);
+    }
+}
+#endif
+
+//w24stats: per-backend dispatch counters, so balancing can be checked under load.
+void sendDispatchStats(w24Reply *reply) {
+    char result[MAX_BUFFER_SIZE * 4];
+    int length = snprintf(result, sizeof(result), "%-12s %6s %6s %8s %6s %8s %9s %9s %s\n",
+                          "backend", "port", "state", "routed", "conns", "inflight", "ewma_ms", "requests", "fallbacks");
+
+    pthread_mutex_lock(&dispatchLock);
+    for (int i = 0; i < numBackends && length < (int)sizeof(result); i++) {
+        const backend *b = &backends[i];
+        const char *state = (i == 0 || b->controlSocket != -1) ? "up" : "down";
+        length += snprintf(result + length, sizeof(result) - length, "%-12s %6d %6s %8lu %6d %8d %9.3f %9lu %lu\n",
+                           b->name, b->port, state, b->routed, b->connections, b->inFlight,
+                           b->ewmaServiceMs, b->requests, b->handoffFailures);
+    }
+    pthread_mutex_unlock(&dispatchLock);
+
+    if (cacheEnabled && length < (int)sizeof(result)) {
+        pthread_mutex_lock(&resultCache.lock);
+        length += snprintf(result + length, sizeof(result) - length,
+                           "cache: %lu hits, %lu misses, %d entries, %llu of %llu bytes\n", resultCache.hits,
+                           resultCache.misses, resultCache.count, resultCache.total, resultCache.budget);
+        pthread_mutex_unlock(&resultCache.lock);
+    }
+    if (admissionEnabled && length < (int)sizeof(result)) {
+        length += admissionStats(&admission, result + length, sizeof(result) - length);
+    }
+    if (blocksEnabled && length < (int)sizeof(result)) {
+        pthread_mutex_lock(&memberBlocks.lock);
+        length += snprintf(result + length, sizeof(result) - length,
+                           "blocks: %lu hits, %lu misses, %zu members, %zu of %zu bytes\n", memberBlocks.hits,
+                           memberBlocks.misses, memberBlocks.count, memberBlocks.total, memberBlocks.budget);
+        pthread_mutex_unlock(&memberBlocks.lock);
+    }
+
+    sendResponse(reply, result);
+}
+
+//This node's metrics in the Prometheus text format; serverw24 adds those of its mirrors that are running,
+//read from their shared memory segments. Returns -1 if out cannot grow.
+int collectMetrics(w24Buffer *out) {
+    const w24Metrics *nodes[MAX_BACKENDS];
+    nodes[0] = metrics;
+    int count = 1;
+    for (int i = 1; i < numBackends; i++) {
+        const w24Metrics *mirror = metricsOpen(backends[i].port);
+        if (mirror) {
+            nodes[count++] = mirror;
+        }
+    }
+    int result = metricsFormat(nodes, count, out);
+    for (int i = 1; i < count; i++) {
+        metricsClose(nodes[i]);
+    }
+    return result;
+}
+
+//w24metrics: the counters and latency quantiles the -m port exports, for a look without Prometheus.
+void sendMetrics(w24Reply *reply) {
+    w24Buffer result;
+    bufferInit(&result);
+    if (collectMetrics(&result) == -1) {
+        sendError(reply, STATUS_ERROR, "Failed to collect metrics");
+    } else {
+        sendReply(reply, STATUS_OK, result.data, result.length);
+    }
+    bufferFree(&result);
+}
+
+void freeRequest(clientRequest *request) {
+    free(request->buffer);
+    free(request);
+}
+
+//Options a command takes ahead of its other arguments.
+#define TAKES_RECURSIVE 1 // -r
+#define TAKES_ARCHIVE 2   // -j N and -c codec[:level][,...]
+#define TAKES_LISTING 4   // dirlist's -a or -t
+
+typedef struct requestOptions {
+    int recursive;
+    const char *listing;
+    const char *threads;
+    const char *codecs;
+} requestOptions;
+
+int commandOptions(const char *command) {
+    if (strcmp(command, "dirlist") == 0) {
+        return TAKES_RECURSIVE | TAKES_LISTING;
+    } else if (strcmp(command, "w24fn") == 0) {
+        return TAKES_RECURSIVE;
+    } else if (strcmp(command, "w24fz") == 0 || strcmp(command, "w24ft") == 0 || strcmp(command, "w24fdb") == 0 ||
+               strcmp(command, "w24fda") == 0) {
+        return TAKES_RECURSIVE | TAKES_ARCHIVE;
+    }
+    return 0;
+}
+
+//Take the options a command accepts off the front of its arguments (argv[0] is the command name itself), leaving
+//the rest in argv[1..]. Options end at the first argument that is not one, or after "--", so a file named -r can
+//still be given. Returns -1 if -j or -c has no value.
+int takeOptions(const char **argv, int *argc, requestOptions *options) {
+    memset(options, 0, sizeof(*options));
+    if (*argc == 0) {
+        return 0;
+    }
+
+    int accepted = commandOptions(argv[0]);
+    int i = 1;
+    for (; i < *argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if ((accepted & TAKES_RECURSIVE) && strcmp(argv[i], "-r") == 0) {
+            options->recursive = 1;
+        } else if ((accepted & TAKES_LISTING) && (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-t") == 0)) {
+            options->listing = argv[i];
+        } else if ((accepted & TAKES_ARCHIVE) && (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-c") == 0)) {
+            if (i + 1 == *argc) {
+                return -1;
+            }
+            if (argv[i][1] == 'j') {
+                options->threads = argv[++i];
+            } else {
+                options->codecs = argv[++i];
+            }
+        } else {
+            break;
+        }
+    }
+
+    int kept = 1;
+    for (; i < *argc; i++) {
+        argv[kept++] = argv[i];
+    }
+    *argc = kept;
+    return 0;
+}
+
+//-j N: compression threads for one archive, at most one per CPU. Returns -1 if N is not a count.
+int parseArchiveThreads(const char *text, archiveOptions *options) {
+    size_t threads;
+    if (parseCount(text, &threads) == -1 || threads == 0) {
+        return -1;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && threads > (size_t)cpus) {
+        threads = cpus;
+    }
+    options->threads = threads;
+    return 0;
+}
+
+//Handling all clients options which are provided by clients. Returns 1 when the client asked to quit.
+int executeRequest(clientRequest *request) {
+    w24Reply *reply = &request->reply;
+    const char **argv = request->argv;
+    int argc = request->argc;
+
+    // -r extends a filter from the top level of HOME to its whole tree; -j N compresses an archive on N threads
+    // and -c codec[:level][,...] picks its compression
+    requestOptions given;
+    if (takeOptions(argv, &argc, &given) == -1) {
+        sendError(reply, STATUS_BAD_REQUEST, "Missing option value");
+        return 0;
+    }
+    int recursive = given.recursive;
+
+    archiveOptions options;
+    archiveOptionsInit(&options);
+    options.blocks = blocksEnabled ? &memberBlocks : NULL;
+    if (given.threads && parseArchiveThreads(given.threads, &options) == -1) {
+        sendError(reply, STATUS_BAD_REQUEST, "Invalid -j thread count");
+        return 0;
+    }
+    if (given.codecs && archiveSelectCodec(given.codecs, &options) == -1) {
+        sendError(reply, STATUS_BAD_REQUEST, "Invalid -c compression level");
+        return 0;
+    }
+
+    if (argc == 0) {
+        // Empty command, nothing to do
+    } else if (strcmp(argv[0], "dirlist") == 0) {
+        size_t offset = 0, limit = SIZE_MAX;
+        if (given.listing && argc <= 3 && (argc < 2 || parseCount(argv[1], &offset) == 0) &&
+            (argc < 3 || parseCount(argv[2], &limit) == 0)) {
+            listDirectories(reply, given.listing, recursive, offset, limit);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid dirlist command syntax");
+        }
+    } else if (strcmp(argv[0], "w24fn") == 0) {
+        if (argc == 2) {
+            getFileDetails(reply, argv[1], recursive);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid w24fn command syntax");
+        }
+    } else if (strcmp(argv[0], "w24fz") == 0) {
+        if (argc == 3) {
+            long long minSize = atoll(argv[1]);
+            long long maxSize = atoll(argv[2]);
+            sendFilesBySizeRange(reply, minSize, maxSize, recursive, &options);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid w24fz command syntax");
+        }
+    } else if (strcmp(argv[0], "w24ft") == 0) {
+        // Any number of extensions, each answered from its posting list
+        if (argc > 1) {
+            sendFilesByExtensions(reply, argv + 1, argc - 1, recursive, &options);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid w24ft command syntax");
+        }
+    } else if (strcmp(argv[0], "w24fdb") == 0) {
+        if (argc == 2) {
+            sendFilesByDateBefore(reply, argv[1], recursive, &options);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid w24fdb command syntax");
+        }
+    } else if (strcmp(argv[0], "w24fda") == 0) {
+        if (argc == 2) {
+            sendFilesByDateAfter(reply, argv[1], recursive, &options);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid w24fda command syntax");
+        }
+    } else if (strcmp(argv[0], "w24get") == 0) {
+        size_t offset = 0, length = SIZE_MAX;
+        if (argc >= 2 && argc <= 4 && strlen(argv[1]) == CACHE_KEY_LEN &&
+            strspn(argv[1], "0123456789abcdef") == CACHE_KEY_LEN && (argc < 3 || parseCount(argv[2], &offset) == 0) &&
+            (argc < 4 || parseCount(argv[3], &length) == 0)) {
+            sendResultRange(reply, argv[1], offset, argc < 4 ? ARCHIVE_TO_END : length);
+        } else {
+            sendError(reply, STATUS_BAD_REQUEST, "Invalid w24get command syntax");
+        }
+    } else if (strcmp(argv[0], "w24stats") == 0) {
+        sendDispatchStats(reply);
+    } else if (strcmp(argv[0], "w24metrics") == 0) {
+        sendMetrics(reply);
+    } else if (strcmp(argv[0], "quitc") == 0) {
+        sendResponse(reply, "Connection closed by client");
+        return 1;
+    } else {
+        sendError(reply, STATUS_BAD_REQUEST, "Invalid command");
+    }
+
+    return 0;
+}
+
+//The first bytes decide the protocol: binary frames start with the magic, anything else is text.
+int detectMode(clientConn *conn) {
+    if (conn->mode != CONN_MODE_UNKNOWN || conn->inLen == 0) {
+        return conn->mode;
+    }
+
+    unsigned char first = conn->inBuf[0];
+    if (first != (W24_MAGIC >> 8)) {
+        conn->mode = CONN_MODE_TEXT;
+    } else if (conn->inLen >= 2) {
+        unsigned char second = conn->inBuf[1];
+        conn->mode = (second == (W24_MAGIC & 0xff)) ? CONN_MODE_BINARY : CONN_MODE_TEXT;
+    }
+    return conn->mode;
+}
+
+//Cut the next complete request out of the connection's input buffer.
+//Returns 1 with *out set, 0 if more bytes are needed, -1 on a protocol error.
+int parseRequest(clientConn *conn, clientRequest **out) {
+    if (conn->inLen == 0 || detectMode(conn) == CONN_MODE_UNKNOWN) {
+        return 0;
+    }
+
+    const char *payload;
+    size_t payloadLength, consumed;
+    w24Header header;
+
+    if (conn->mode == CONN_MODE_BINARY) {
+        if (conn->inLen < W24_HEADER_LEN) {
+            return 0;
+        }
+        if (decodeHeader((unsigned char *)conn->inBuf, &header) == -1 ||
+            header.payloadLength > W24_MAX_REQUEST_PAYLOAD) {
+            fprintf(stderr, "Connection %d: Invalid frame\n", conn->id);
+            return -1;
+        }
+        if (conn->inLen < W24_HEADER_LEN + header.payloadLength) {
+            return 0;
+        }
+        payload = conn->inBuf + W24_HEADER_LEN;
+        payloadLength = header.payloadLength;
+        consumed = W24_HEADER_LEN + payloadLength;
+    } else {
+        // One command per line; legacy clients send a bare command per write, so take everything buffered
+        char *newline = memchr(conn->inBuf, '\n', conn->inLen);
+        payload = conn->inBuf;
+        payloadLength = newline ? (size_t)(newline - conn->inBuf) : conn->inLen;
+        consumed = newline ? payloadLength + 1 : payloadLength;
+    }
+
+    // At most one token per two bytes, plus the command itself for binary frames
+    clientRequest *request = malloc(sizeof(clientRequest) + sizeof(const char *) * (payloadLength / 2 + 2));
+    char *buffer = request ? malloc(payloadLength + 1) : NULL;
+    if (!buffer) {
+        free(request);
+        return -1;
+    }
+    memcpy(buffer, payload, payloadLength);
+    buffer[payloadLength] = '\0';
+    memmove(conn->inBuf, conn->inBuf + consumed, conn->inLen - consumed);
+    conn->inLen -= consumed;
+
+    request->conn = conn;
+    request->buffer = buffer;
+    request->argc = 0;
+    request->reply.socket = conn->fd;
+    request->reply.binary = (conn->mode == CONN_MODE_BINARY);
+    request->reply.requestId = 0;
+    request->reply.opcode = 0;
+    request->reply.writeLock = &conn->writeLock;
+    request->reply.sent = &request->sent;
+    request->sent = 0;
+#ifdef W24_USE_IO_URING
+    request->reply.output = &conn->output;
+#else
+    request->reply.output = NULL;
+#endif
+
+    if (request->reply.binary) {
+        // The opcode names the command, the payload holds its arguments
+        const char *command = opcodeCommand(header.opcode);
+        request->reply.requestId = header.requestId;
+        request->reply.opcode = header.opcode;
+        request->argv[request->argc++] = command ? command : "";
+    }
+
+    // Parse command into arguments
+    char *savePtr;
+    char *token = strtok_r(buffer, " \r\n", &savePtr);
+    while (token != NULL) {
+        request->argv[request->argc++] = token;
+        token = strtok_r(NULL, " \r\n", &savePtr);
+    }
+    if (!request->reply.binary && request->argc > 0) {
+        int opcode = commandOpcode(request->argv[0]);
+        request->reply.opcode = opcode > 0 ? opcode : 0;
+    }
+
+    *out = request;
+    return 1;
+}
+
+//Worker job: run the request, then keep serving requests that are already buffered before handing
+//the socket back to the reactor.
+void handleClient(void *arg) {
+    clientRequest *request = (clientRequest *)arg;
+    clientConn *conn = request->conn;
+
+    while (1) {
+        double start = monotonicMs();
+        int quit = executeRequest(request);
+        requestFinished(request, monotonicMs() - start);
+        freeRequest(request);
+
+        if (quit) {
+            closeClient(conn);
+            return;
+        }
+
+        int parsed = parseRequest(conn, &request);
+        if (parsed == 1) {
+            requestStarted(conn);
+            continue;
+        }
+        if (parsed == -1) {
+            closeClient(conn);
+        } else {
+            rearmClient(conn);
+        }
+        return;
+    }
+}
+
+//Make room for more input after what the client's buffer holds. Returns 0 if there is room, 1 if the buffer
+//is already as large as any request needs, -1 if it cannot grow.
+int reserveClientInput(clientConn *conn) {
+    if (conn->inCap - conn->inLen >= MAX_BUFFER_SIZE) {
+        return 0;
+    }
+    if (conn->inCap >= W24_HEADER_LEN + W24_MAX_REQUEST_PAYLOAD + MAX_BUFFER_SIZE) {
+        return 1; // Plenty buffered; let the workers catch up before reading more
+    }
+    size_t capacity = conn->inCap ? conn->inCap * 2 : MAX_BUFFER_SIZE * 4;
+    char *inBuf = realloc(conn->inBuf, capacity);
+    if (!inBuf) {
+        return -1;
+    }
+    conn->inBuf = inBuf;
+    conn->inCap = capacity;
+    return 0;
+}
+
+//Drain everything the client has sent into its input buffer (edge-triggered, so read until EAGAIN).
+//Returns 0 once the socket is drained, 1 if the buffer filled up first, -1 when the client disconnected
+//or the socket failed.
+int readClientInput(clientConn *conn) {
+    while (1) {
+        int reserved = reserveClientInput(conn);
+        if (reserved != 0) {
+            return reserved;
+        }
+
+        ssize_t bytesRead = recv(conn->fd, conn->inBuf + conn->inLen, conn->inCap - conn->inLen, 0);
+        if (bytesRead > 0) {
+            conn->inLen += bytesRead;
+            continue;
+        }
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0; // Everything available has been read (possibly nothing on a spurious wakeup)
+        }
+        if (bytesRead == -1) {
+            perror("Error reading from socket");
+        }
+        return -1;
+    }
+}
+
+//Account for a finished binary request and resume reading if the pipeline has room again.
+void finishPipelinedRequest(clientConn *conn) {
+    pthread_mutex_lock(&conn->lock);
+    conn->inFlight--;
+    int resume = conn->paused && !conn->closing;
+    if (resume) {
+        conn->paused = 0;
+        conn->refCount++;
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    if (resume) {
+        queueResume(conn);
+    }
+    releaseClient(conn);
+}
+
+//Worker job for one binary request. Responses carry the request id, so requests on the same
+//connection may finish in any order.
+void handlePipelinedRequest(void *arg) {
+    clientRequest *request = (clientRequest *)arg;
+    clientConn *conn = request->conn;
+
+    double start = monotonicMs();
+    int quit = executeRequest(request);
+    requestFinished(request, monotonicMs() - start);
+    freeRequest(request);
+
+    if (quit) {
+        pthread_mutex_lock(&conn->lock);
+        conn->closing = 1;
+        pthread_mutex_unlock(&conn->lock);
+        shutdown(conn->fd, SHUT_RD); // The reactor sees end of input and drops its registration
+    }
+    finishPipelinedRequest(conn);
+}
+
+//Queue every complete frame in the input buffer, up to MAX_PIPELINE in flight.
+//Returns 1 if it paused at the limit (the last request to finish resumes the connection), 0 once the
+//buffer holds no complete frame or the client quit, and -1 on a protocol error.
+int dispatchFrames(threadPool *pool, clientConn *conn) {
+    while (1) {
+        pthread_mutex_lock(&conn->lock);
+        int stop = conn->closing || conn->inFlight >= MAX_PIPELINE;
+        conn->paused = stop && !conn->closing;
+        int paused = conn->paused;
+        pthread_mutex_unlock(&conn->lock);
+        if (stop) {
+            return paused;
+        }
+
+        clientRequest *request;
+        int parsed = parseRequest(conn, &request);
+        if (parsed != 1) {
+            return parsed;
+        }
+
+        pthread_mutex_lock(&conn->lock);
+        conn->inFlight++;
+        conn->refCount++;
+        pthread_mutex_unlock(&conn->lock);
+
+        requestStarted(conn);
+        if (threadPoolSubmit(pool, handlePipelinedRequest, request) == -1) {
+            fprintf(stderr, "Failed to queue request\n");
+            requestFinished(request, 0);
+            freeRequest(request);
+            finishPipelinedRequest(conn);
+            return -1;
+        }
+    }
+}
+
+//Reactor side of a binary connection: read and queue requests until the socket is drained,
+//the pipeline is full or the client has gone.
+void pumpClient(threadPool *pool, clientConn *conn) {
+    while (1) {
+        int status = readClientInput(conn);
+        if (dispatchFrames(pool, conn) == -1 || status == -1) {
+            closeClient(conn);
+            return;
+        }
+
+        pthread_mutex_lock(&conn->lock);
+        int paused = conn->paused;
+        pthread_mutex_unlock(&conn->lock);
+        if (status == 0 || paused) {
+            return;
+        }
+    }
+}
+
+#ifdef W24_USE_IO_URING
+//Queue a receive into the free end of the client's input buffer. Reactor only; the buffer is not touched
+//again until the receive completes.
+void receiveClientInput(clientConn *conn) {
+    if (conn->recvPending) {
+        return;
+    }
+    if (reserveClientInput(conn) == -1 || conn->inLen == conn->inCap) {
+        closeClient(conn);
+        return;
+    }
+
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepRecv(sqe, conn->fd, conn->inBuf + conn->inLen, conn->inCap - conn->inLen, (uintptr_t)conn | RING_RECV);
+        ringPublish(&ring);
+    }
+    pthread_mutex_unlock(&ring.lock);
+    if (!sqe) {
+        closeClient(conn);
+        return;
+    }
+    conn->recvPending = 1;
+}
+
+//Reactor side of a connection on the ring: queue the requests buffered so far, then receive more unless a
+//worker owns the buffer (text mode) or the pipeline is full.
+void serveClientInput(threadPool *pool, clientConn *conn) {
+    if (detectMode(conn) == CONN_MODE_BINARY) {
+        int status = dispatchFrames(pool, conn);
+        if (status == -1) {
+            closeClient(conn);
+        } else if (status == 0) {
+            receiveClientInput(conn);
+        }
+        return;
+    }
+
+    clientRequest *request;
+    int parsed = parseRequest(conn, &request);
+    if (parsed == -1) {
+        closeClient(conn);
+        return;
+    }
+    if (parsed == 0) {
+        receiveClientInput(conn); // Partial request; wait for the rest
+        return;
+    }
+    requestStarted(conn);
+    if (threadPoolSubmit(pool, handleClient, request) == -1) {
+        fprintf(stderr, "Failed to queue request\n");
+        requestFinished(request, 0);
+        freeRequest(request);
+        closeClient(conn);
+    }
+}
+
+//Put the unsent rest of the oldest queued chunk on the ring. The caller holds conn->lock; the send holds a
+//reference until the queue is empty.
+void sendQueuedOutput(clientConn *conn) {
+    outputChunk *chunk = conn->outHead;
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepSend(sqe, conn->fd, chunk->data + chunk->sent, chunk->length - chunk->sent, MSG_NOSIGNAL,
+                     (uintptr_t)conn | RING_SEND);
+        ringPublish(&ring);
+    }
+    pthread_mutex_unlock(&ring.lock);
+
+    if (!sqe) {
+        conn->outputFailed = 1;
+        pthread_cond_broadcast(&conn->outputSpace);
+        return;
+    }
+    if (!conn->sending) {
+        conn->sending = 1;
+        conn->refCount++;
+    }
+}
+
+//w24Output write: send the frame right away if nothing is queued ahead of it and the socket takes it, and
+//otherwise queue a copy of what is left for the ring, which sends it once the socket has room. Waits while
+//more than OUTPUT_MAX_QUEUED bytes are queued, so archives cannot outrun the client.
+int queueOutput(w24Output *output, const struct iovec *iov, int count) {
+    clientConn *conn = (clientConn *)((char *)output - offsetof(clientConn, output));
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += iov[i].iov_len;
+    }
+    if (length == 0) {
+        return 0; // An empty text reply; a zero-length send would look like a closed socket
+    }
+
+    pthread_mutex_lock(&conn->lock);
+    while (conn->outBytes > OUTPUT_MAX_QUEUED && !conn->outputFailed) {
+        pthread_cond_wait(&conn->outputSpace, &conn->lock);
+    }
+    if (conn->outputFailed) {
+        pthread_mutex_unlock(&conn->lock);
+        return -1;
+    }
+
+    size_t sent = 0;
+    if (!conn->sending && !conn->claimed) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = count;
+        ssize_t result;
+        do {
+            result = sendmsg(conn->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } while (result == -1 && errno == EINTR);
+        if (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            conn->outputFailed = 1;
+            pthread_cond_broadcast(&conn->outputSpace);
+            pthread_mutex_unlock(&conn->lock);
+            return -1;
+        }
+        sent = result > 0 ? result : 0;
+        if (sent == length) {
+            pthread_mutex_unlock(&conn->lock);
+            return 0;
+        }
+    }
+
+    outputChunk *chunk = malloc(sizeof(outputChunk) + length - sent);
+    if (!chunk) {
+        pthread_mutex_unlock(&conn->lock);
+        return -1;
+    }
+    chunk->next = NULL;
+    chunk->length = length - sent;
+    chunk->sent = 0;
+    size_t at = 0;
+    for (int i = 0; i < count; i++) {
+        size_t skip = sent < iov[i].iov_len ? sent : iov[i].iov_len;
+        memcpy(chunk->data + at, (const char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        at += iov[i].iov_len - skip;
+        sent -= skip;
+    }
+
+    if (conn->outTail) {
+        conn->outTail->next = chunk;
+    } else {
+        conn->outHead = chunk;
+    }
+    conn->outTail = chunk;
+    conn->outBytes += chunk->length;
+    int start = !conn->sending && !conn->claimed;
+    if (start) {
+        sendQueuedOutput(conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    if (start && ringSubmit(&ring, 0) == -1) {
+        perror("io_uring submit failed");
+    }
+    return 0;
+}
+
+//w24Output claim: wait until every queued byte is sent, then keep the ring off the socket until release.
+int claimOutput(w24Output *output) {
+    clientConn *conn = (clientConn *)((char *)output - offsetof(clientConn, output));
+    pthread_mutex_lock(&conn->lock);
+    while ((conn->sending || conn->claimed) && !conn->outputFailed) {
+        pthread_cond_wait(&conn->outputSpace, &conn->lock);
+    }
+    int failed = conn->outputFailed;
+    conn->claimed = !failed;
+    pthread_mutex_unlock(&conn->lock);
+    return failed ? -1 : 0;
+}
+
+//w24Output release: send whatever other requests queued in the meantime.
+void releaseOutput(w24Output *output) {
+    clientConn *conn = (clientConn *)((char *)output - offsetof(clientConn, output));
+    pthread_mutex_lock(&conn->lock);
+    conn->claimed = 0;
+    int start = conn->outHead != NULL && !conn->outputFailed;
+    if (start) {
+        sendQueuedOutput(conn);
+    }
+    pthread_cond_broadcast(&conn->outputSpace);
+    pthread_mutex_unlock(&conn->lock);
+
+    if (start && ringSubmit(&ring, 0) == -1) {
+        perror("io_uring submit failed");
+    }
+}
+
+//A send completed: drop what went out and send the rest, or fail every queued and future write if the
+//client is gone. Reactor only.
+void outputSent(clientConn *conn, int result) {
+    pthread_mutex_lock(&conn->lock);
+    if (result == -EINTR || result == -EAGAIN) {
+        // Nothing sent; try again
+    } else if (result <= 0) {
+        conn->outputFailed = 1;
+        while (conn->outHead != NULL) {
+            outputChunk *next = conn->outHead->next;
+            free(conn->outHead);
+            conn->outHead = next;
+        }
+        conn->outTail = NULL;
+        conn->outBytes = 0;
+    } else {
+        outputChunk *chunk = conn->outHead;
+        chunk->sent += result;
+        if (chunk->sent == chunk->length) {
+            conn->outHead = chunk->next;
+            if (conn->outHead == NULL) {
+                conn->outTail = NULL;
+            }
+            conn->outBytes -= chunk->length;
+            free(chunk);
+        }
+    }
+
+    int more = conn->outHead != NULL && !conn->outputFailed;
+    if (more) {
+        sendQueuedOutput(conn);
+    }
+    int done = !more || conn->outputFailed;
+    if (done) {
+        conn->sending = 0;
+    }
+    pthread_cond_broadcast(&conn->outputSpace);
+    pthread_mutex_unlock(&conn->lock);
+
+    if (done) {
+        releaseClient(conn);
+    }
+}
+#endif
+
+//Pump the connections workers resumed since the last wakeup.
+void resumeClients(threadPool *pool) {
+    uint64_t count;
+    if (read(wakeupFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("Failed to read wakeup counter");
+    }
+
+    pthread_mutex_lock(&resumeLock);
+    clientConn *conn = resumeList;
+    resumeList = NULL;
+    pthread_mutex_unlock(&resumeLock);
+
+    while (conn != NULL) {
+        clientConn *next = conn->resumeNext;
+        pthread_mutex_lock(&conn->lock);
+        int registered = conn->registered;
+        pthread_mutex_unlock(&conn->lock);
+#ifdef W24_USE_IO_URING
+        // A receive on the ring dispatches what is buffered when it completes
+        if (registered && !conn->recvPending) {
+            serveClientInput(pool, conn);
+        }
+#else
+        if (registered) {
+            pumpClient(pool, conn);
+        }
+#endif
+        releaseClient(conn);
+        conn = next;
+    }
+}
+
+//Register a freshly accepted or handed-off client with the reactor. A handed-off client brings a reference
+//to the control connection it arrived on.
+void addClient(int clientSocket, int clientCount, controlConn *control) {
+    clientConn *conn = malloc(sizeof(clientConn));
+#ifdef W24_USE_IO_URING
+    // The ring waits for the socket itself; a non-blocking socket would only hand back EAGAIN
+    if (!conn) {
+#else
+    if (!conn || setNonBlocking(clientSocket) == -1) {
+#endif
+        perror("Failed to set up client connection");
+        free(conn);
+        close(clientSocket);
+        connectionFinished(clientCount, control);
+        return;
+    }
+    conn->source = SOURCE_CLIENT;
+    conn->fd = clientSocket;
+    conn->id = clientCount;
+    conn->mode = CONN_MODE_UNKNOWN;
+    conn->inBuf = NULL;
+    conn->inLen = 0;
+    conn->inCap = 0;
+    pthread_mutex_init(&conn->writeLock, NULL);
+    pthread_mutex_init(&conn->lock, NULL);
+    conn->refCount = 1;
+    conn->registered = 1;
+    conn->inFlight = 0;
+    conn->paused = 0;
+    conn->closing = 0;
+    conn->resumeNext = NULL;
+    conn->control = control;
+    metricsConnection(metrics, 1);
+
+#ifdef W24_USE_IO_URING
+    conn->recvPending = 0;
+    conn->output.write = queueOutput;
+    conn->output.claim = claimOutput;
+    conn->output.release = releaseOutput;
+    conn->outHead = NULL;
+    conn->outTail = NULL;
+    conn->outBytes = 0;
+    conn->sending = 0;
+    conn->claimed = 0;
+    conn->outputFailed = 0;
+    pthread_cond_init(&conn->outputSpace, NULL);
+    receiveClientInput(conn);
+#else
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &ev) == -1) {
+        perror("epoll_ctl add failed");
+        conn->registered = 0;
+        releaseClient(conn);
+    }
+#endif
+}
+
+//Tell a connection there is no room for it and close it.
+void turnAway(int clientSocket, int clientCount, controlConn *control) {
+    char message[64];
+    int length = snprintf(message, sizeof(message), "%s is busy. Try again later.\n", node.name);
+    send(clientSocket, message, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(clientSocket);
+    connectionFinished(clientCount, control);
+}
+
+//Serve a new connection here if it gets a slot; otherwise it waits in the admission queue, or is turned away
+//when the queue is full. Reactor only.
+void admitClient(int clientSocket, int clientCount, controlConn *control) {
+    if (!admissionEnabled) {
+        addClient(clientSocket, clientCount, control);
+        return;
+    }
+
+    int decision = admissionEnter(&admission, clientSocket, clientCount, control, monotonicMs());
+    if (decision == ADMIT_NOW) {
+        addClient(clientSocket, clientCount, control);
+    } else if (decision == ADMIT_REJECTED) {
+        printf("Connection %d: Admission queue full, turned away\n", clientCount);
+        turnAway(clientSocket, clientCount, control);
+    }
+}
+
+//Serve the waiting connections that have a slot now, oldest first, and turn away those that waited longer
+//than the timeout. Reactor only.
+void admitWaiting(void) {
+    admissionWaiter waiter;
+    int action;
+    while ((action = admissionNext(&admission, monotonicMs(), &waiter)) != 0) {
+        if (action == 1) {
+            addClient(waiter.fd, waiter.id, waiter.context);
+        } else {
+            printf("Connection %d: No slot within %d ms, turned away\n", waiter.id, admission.timeoutMs);
+            turnAway(waiter.fd, waiter.id, waiter.context);
+        }
+    }
+}
+
+//Route a new connection to the least busy node. A client assigned to an unreachable mirror is served here instead.
+void routeClient(int clientSocket, int clientCount) {
+    backend *b = chooseBackend();
+
+    if (b == &backends[0]) {
+        printf("Connection %d: Handled by %s\n", clientCount, b->name);
+        admitClient(clientSocket, clientCount, NULL);
+        return;
+    }
+
+    if (forwardToMirror(clientSocket, b, clientCount) == 0) {
+        printf("Connection %d: Handled by %s\n", clientCount, b->name);
+        close(clientSocket); // The mirror holds its own copy of the descriptor now
+        return;
+    }
+
+    pthread_mutex_lock(&dispatchLock);
+    b->connections--;
+    b->handoffFailures++;
+    backends[0].connections++;
+    pthread_mutex_unlock(&dispatchLock);
+
+    printf("Connection %d: %s unavailable, handled by %s\n", clientCount, b->name, backends[0].name);
+    admitClient(clientSocket, clientCount, NULL);
+}
+
+//On a mirror: take every client serverw24 handed off on the control connection and serve it like one that
+//connected directly. Returns 0 once serverw24 has closed the connection; the clients it handed off keep it
+//open for their reports until they are done. Reactor only.
+int receiveHandoffs(controlConn *control) {
+    while (1) {
+        int connectionId;
+        struct iovec iov = { .iov_base = &connectionId, .iov_len = sizeof(connectionId) };
+        char cmsgBuffer[CMSG_SPACE(sizeof(int))];
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsgBuffer;
+        msg.msg_controllen = sizeof(cmsgBuffer);
+
+        // The socket stays blocking for the load reports, so only this receive is non-blocking
+        ssize_t bytesRead = recvmsg(control->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        if (bytesRead <= 0) {
+            printf("Lost control connection from serverw24\n");
+#ifndef W24_USE_IO_URING
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, control->fd, NULL);
+#endif
+            releaseControl(control);
+            return 0;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            fprintf(stderr, "Control message without a client socket\n");
+            continue;
+        }
+        int clientSocket;
+        memcpy(&clientSocket, CMSG_DATA(cmsg), sizeof(int));
+
+        printf("Connection %d: Handed off by serverw24\n", connectionId);
+        pthread_mutex_lock(&dispatchLock);
+        backends[0].routed++;
+        backends[0].connections++;
+        pthread_mutex_unlock(&dispatchLock);
+        pthread_mutex_lock(&control->lock);
+        control->refCount++;
+        pthread_mutex_unlock(&control->lock);
+        admitClient(clientSocket, connectionId, control);
+    }
+}
+
+#ifdef W24_USE_IO_URING
+//Queue a one-shot poll for handoffs on a control connection; the reactor queues the next one after taking them.
+void pollControl(controlConn *control) {
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepPoll(sqe, control->fd, POLLIN, (uintptr_t)control | RING_CONTROL);
+        ringPublish(&ring);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+#endif
+
+//Start watching a control connection serverw24 opened to this mirror. Reactor only.
+void addControl(int controlSocket) {
+    controlConn *control = malloc(sizeof(controlConn));
+    if (!control) {
+        perror("Failed to set up control connection");
+        close(controlSocket);
+        return;
+    }
+    control->source = SOURCE_CONTROL;
+    control->fd = controlSocket;
+    pthread_mutex_init(&control->lock, NULL);
+    control->refCount = 1;
+
+#ifdef W24_USE_IO_URING
+    pollControl(control);
+#else
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = control;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, controlSocket, &ev) == -1) {
+        perror("epoll_ctl add failed");
+        releaseControl(control);
+        return;
+    }
+    receiveHandoffs(control); // Edge-triggered: take what arrived before the socket was registered
+#endif
+}
+
+//On a mirror: create the control socket serverw24 hands clients off on, named after the port. Returns -1 on
+//failure.
+//-m: answer every HTTP request on the metrics port with the metrics, one scrape at a time. It runs on a
+//thread of its own, so scrapes never wait behind clients or hold up the reactor.
+void *metricsThread(void *arg) {
+    (void)arg;
+    while (1) {
+        int fd = accept(metricsListener, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Metrics accept failed");
+            return NULL;
+        }
+
+        // Whatever the path, the answer is the metrics; just read the request so closing does not reset it
+        char request[MAX_BUFFER_SIZE];
+        struct timeval timeout = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        recv(fd, request, sizeof(request), 0);
+
+        w24Buffer body;
+        bufferInit(&body);
+        char header[160];
+        int headerLength;
+        if (collectMetrics(&body) == 0) {
+            headerLength = snprintf(header, sizeof(header),
+                                    "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                    "Content-Length: %zu\r\n\r\n", body.length);
+        } else {
+            headerLength = snprintf(header, sizeof(header), "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+            body.length = 0;
+        }
+        if (sendAll(fd, header, headerLength) == 0 && body.length > 0) {
+            sendAll(fd, body.data, body.length);
+        }
+        bufferFree(&body);
+        close(fd);
+    }
+}
+
+//Listen on the metrics port and start the thread that serves it. Returns -1 on failure.
+int openMetricsPort(int port) {
+    metricsListener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metricsListener == -1) {
+        perror("Metrics socket creation failed");
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(metricsListener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    pthread_t thread;
+    if (bind(metricsListener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(metricsListener, 16) == -1 ||
+        pthread_create(&thread, NULL, metricsThread, NULL) != 0) {
+        perror("Failed to open the metrics port");
+        close(metricsListener);
+        metricsListener = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+int openControlListener(int port) {
+    struct sockaddr_un ctlAddr;
+    memset(&ctlAddr, 0, sizeof(ctlAddr));
+    ctlAddr.sun_family = AF_UNIX;
+    snprintf(ctlAddr.sun_path, sizeof(ctlAddr.sun_path), MIRROR_CTL_PATH_FMT, port);
+    unlink(ctlAddr.sun_path);
+
+    controlListener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (controlListener == -1 || bind(controlListener, (struct sockaddr *)&ctlAddr, sizeof(ctlAddr)) == -1 ||
+        listen(controlListener, MAX_CONTROLS) == -1) {
+        perror("Control socket setup failed");
+        return -1;
+    }
+    return 0;
+}
+
+
+#ifndef W24_USE_IO_URING
+//Create the epoll reactor and register the listening sockets and the wakeup eventfd. Returns -1 on failure.
+int initReactor(int serverSocket) {
+    epollFd = epoll_create1(0);
+    if (epollFd == -1) {
+        perror("epoll creation failed");
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL; // NULL marks the listening socket
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocket, &ev) == -1) {
+        perror("epoll_ctl add failed");
+        return -1;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &wakeupSource;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &ev) == -1) {
+        perror("eventfd setup failed");
+        return -1;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &controlListenerSource;
+    if (controlListener != -1 && epoll_ctl(epollFd, EPOLL_CTL_ADD, controlListener, &ev) == -1) {
+        perror("epoll_ctl add failed");
+        return -1;
+    }
+    return 0;
+}
+
+//Serve clients until epoll fails: accept, read and parse here, and execute the requests on the pool.
+void runReactor(threadPool *pool, int serverSocket) {
+    int clientCount = 0;
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        // While connections wait for a slot, wake up in time to turn away the oldest
+        int timeoutMs = admissionEnabled ? admissionTimeout(&admission, monotonicMs()) : -1;
+        int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+        if (numEvents == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+
+        int resumePending = 0;
+        for (int e = 0; e < numEvents; e++) {
+            int *source = events[e].data.ptr;
+
+            if (source != NULL && *source == SOURCE_BACKEND) {
+                // A mirror reported a change in its load
+                readMirrorReports((backend *)source);
+                continue;
+            }
+
+            if (source != NULL && *source == SOURCE_WAKEUP) {
+                resumePending = 1; // Handled after this batch, when no other event can still name the connections
+                continue;
+            }
+
+            if (source != NULL && *source == SOURCE_CONTROL) {
+                // serverw24 handed clients off to this mirror
+                receiveHandoffs((controlConn *)source);
+                continue;
+            }
+
+            if (source != NULL && *source == SOURCE_CONTROL_LISTENER) {
+                int controlSocket;
+                while ((controlSocket = accept4(controlListener, NULL, NULL, SOCK_CLOEXEC)) != -1 || errno == EINTR) {
+                    if (controlSocket != -1) {
+                        addControl(controlSocket);
+                    }
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("Control accept failed");
+                }
+                continue;
+            }
+
+            if (source != NULL) {
+                // Client socket is readable: parse the command and hand it to a worker
+                clientConn *conn = (clientConn *)source;
+                clientRequest *request;
+                if (conn->mode == CONN_MODE_BINARY) {
+                    pumpClient(pool, conn);
+                    continue;
+                }
+
+                int status = readClientInput(conn);
+                if (detectMode(conn) == CONN_MODE_BINARY) {
+                    // Binary clients may pipeline: keep the socket armed and let MAX_PIPELINE pace reading
+                    struct epoll_event clientEv;
+                    clientEv.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                    clientEv.data.ptr = conn;
+                    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &clientEv) == -1) {
+                        perror("epoll_ctl rearm failed");
+                        closeClient(conn);
+                    } else {
+                        pumpClient(pool, conn);
+                    }
+                    continue;
+                }
+                if (status == -1) {
+                    closeClient(conn);
+                    continue;
+                }
+                int parsed = parseRequest(conn, &request);
+                if (parsed == -1) {
+                    closeClient(conn);
+                    continue;
+                }
+                if (parsed == 0) {
+                    rearmClient(conn); // Partial request; wait for the rest
+                    continue;
+                }
+                requestStarted(conn);
+                if (threadPoolSubmit(pool, handleClient, request) == -1) {
+                    fprintf(stderr, "Failed to queue request\n");
+                    requestFinished(request, 0);
+                    freeRequest(request);
+                    closeClient(conn);
+                }
+                continue;
+            }
+
+            // Listening socket is readable: accept every pending connection (edge-triggered)
+            while (1) {
+                struct sockaddr_in clientAddr;
+                socklen_t clientAddrLen = sizeof(clientAddr);
+                int clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &clientAddrLen);
+                if (clientSocket == -1) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        perror("Socket accept failed");
+                    }
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+
+                // Responses end with small frames (archive end, last chunk); do not let Nagle hold them back
+                int noDelay = 1;
+                setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+                clientCount++;
+                routeClient(clientSocket, clientCount);
+            }
+        }
+
+        if (resumePending) {
+            resumeClients(pool);
+        }
+        if (admissionEnabled) {
+            admitWaiting();
+        }
+    }
+
+    close(epollFd);
+}
+#else
+//Queue an accept of the next connection on listener; a multishot accept keeps yielding connections until it
+//ends. Accepts on a mirror's control listener carry controlListenerSource in the user data.
+void acceptClients(int listener) {
+    uint64_t userData = RING_ACCEPT | (listener == controlListener ? (uintptr_t)&controlListenerSource : 0);
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepAccept(sqe, listener, acceptMultishot, userData);
+        ringPublish(&ring);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+//Queue a one-shot poll of the eventfd workers use to wake the reactor.
+void pollWakeup(void) {
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepPoll(sqe, wakeupFd, POLLIN, RING_WAKEUP);
+        ringPublish(&ring);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+//Queue a timer that wakes the reactor after timeoutMs, so connections that waited too long for a slot are
+//turned away even when nothing else happens.
+void armAdmissionTimer(int timeoutMs) {
+    static struct __kernel_timespec timeout; // Read by the kernel until the timer completes
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+    pthread_mutex_lock(&ring.lock);
+    struct io_uring_sqe *sqe = ringGetSqe(&ring);
+    if (sqe) {
+        ringPrepTimeout(sqe, &timeout, RING_TIMEOUT);
+        ringPublish(&ring);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+//Create the ring and queue the accepts and the wakeup poll. Returns -1 if the kernel has no io_uring.
+int initReactor(int serverSocket) {
+    if (ringInit(&ring, RING_ENTRIES, RING_COMPLETIONS) == -1) {
+        perror("io_uring setup failed");
+        return -1;
+    }
+    acceptClients(serverSocket);
+    if (controlListener != -1) {
+        acceptClients(controlListener);
+    }
+    pollWakeup();
+    return 0;
+}
+
+//Serve clients until the ring fails. Accepts, receives and reply sends all complete here; each loop submits
+//everything queued since the previous one and waits in the same system call.
+void runReactor(threadPool *pool, int serverSocket) {
+    int clientCount = 0;
+    int timerPending = 0;
+    while (1) {
+        if (admissionEnabled && !timerPending) {
+            int timeoutMs = admissionTimeout(&admission, monotonicMs());
+            if (timeoutMs >= 0) {
+                armAdmissionTimer(timeoutMs);
+                timerPending = 1;
+            }
+        }
+        if (ringSubmit(&ring, 1) == -1) {
+            perror("io_uring wait failed");
+            break;
+        }
+
+        int resumePending = 0;
+        struct io_uring_cqe *cqe;
+        while ((cqe = ringPeek(&ring)) != NULL) {
+            uint64_t userData = cqe->user_data;
+            int result = cqe->res;
+            int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            ringAdvance(&ring);
+            int tag = userData & RING_TAG_MASK;
+            void *object = (void *)(uintptr_t)(userData & ~(uint64_t)RING_TAG_MASK);
+
+            if (tag == RING_RECV) {
+                clientConn *conn = object;
+                conn->recvPending = 0;
+                if (result == -EINTR || result == -EAGAIN) {
+                    receiveClientInput(conn);
+                } else if (result <= 0) {
+                    if (result < 0) {
+                        errno = -result;
+                        perror("Error reading from socket");
+                    }
+                    closeClient(conn);
+                } else {
+                    conn->inLen += result;
+                    serveClientInput(pool, conn);
+                }
+            } else if (tag == RING_TIMEOUT) {
+                timerPending = 0; // The queue is checked after this batch
+            } else if (tag == RING_SEND) {
+                outputSent(object, result);
+            } else if (tag == RING_WAKEUP) {
+                resumePending = 1; // Handled after this batch, when no other completion can still name the connections
+                pollWakeup();
+            } else if (tag == RING_MIRROR) {
+                // A mirror reported a change in its load (or the poll of a closed control socket ended)
+                backend *b = object;
+                b->polled = 0;
+                if (result > 0 && b->controlSocket != -1) {
+                    readMirrorReports(b);
+                }
+                if (b->controlSocket != -1) {
+                    pollMirror(b);
+                }
+            } else if (tag == RING_CONTROL) {
+                // serverw24 handed clients off to this mirror (or closed the control connection)
+                controlConn *control = object;
+                if (receiveHandoffs(control)) {
+                    pollControl(control);
+                }
+            } else if (tag == RING_ACCEPT) {
+                int listener = object != NULL ? controlListener : serverSocket;
+                if (result >= 0 && listener == controlListener) {
+                    addControl(result);
+                } else if (result >= 0) {
+                    // Responses end with small frames (archive end, last chunk); do not let Nagle hold them back
+                    int noDelay = 1;
+                    setsockopt(result, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+                    clientCount++;
+                    routeClient(result, clientCount);
+                } else if (result == -EINVAL && acceptMultishot) {
+                    acceptMultishot = 0; // Kernel before 5.19: one accept per connection
+                } else if (result != -EINTR && result != -EAGAIN) {
+                    errno = -result;
+                    perror("Socket accept failed");
+                }
+                if (!more) {
+                    acceptClients(listener);
+                }
+            }
+        }
+
+        if (resumePending) {
+            resumeClients(pool);
+        }
+        if (admissionEnabled) {
+            admitWaiting();
+        }
+    }
+
+    ringFree(&ring);
+}
+#endif
+
+
+void printUsage(const char *program) {
+    if (node.role == SERVER_ROLE_MIRROR) {
+        fprintf(stderr, "Usage: %s [port_number] [-w worker_threads] [-C cache_dir] [-M cache_mb] [-K block_cache_mb] [-a max_clients [-q queue_length] [-T queue_timeout_ms]] [-m metrics_port] [-b index|walk|scan|gzip|codec|pipeline|blocks|ext]\n", program);
+    } else {
+        fprintf(stderr, "Usage: %s <port_number> [-w worker_threads] [-c mirror_config] [-d p2c|least] [-C cache_dir] [-M cache_mb] [-K block_cache_mb] [-a max_clients [-q queue_length] [-T queue_timeout_ms]] [-m metrics_port] [-b index|walk|scan|gzip|codec|pipeline|blocks|ext]\n", program);
+    }
+}
+
+int serverMain(const serverConfig *config, int argc, char *argv[]) {
+    node = *config;
+    int numWorkers = DEFAULT_WORKER_THREADS;
+    const char *mirrorConfig = NULL;
+    const char *cacheDir = NULL;
+    long cacheMb = DEFAULT_CACHE_MB;
+    long blockCacheMb = DEFAULT_BLOCK_CACHE_MB;
+    int maxActive = 0;
+    int maxQueued = DEFAULT_ADMISSION_QUEUE;
+    int queueTimeoutMs = DEFAULT_ADMISSION_TIMEOUT_MS;
+    int metricsPort = 0;
+    int opt;
+
+    // sendfile has no MSG_NOSIGNAL: a client leaving mid-file must fail the send, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    while ((opt = getopt(argc, argv, "w:c:d:b:C:M:K:a:q:T:m:")) != -1) {
+        if (opt == 'b' && strcmp(optarg, "index") == 0) {
+            // Benchmarks run in-process against HOME and exit
+            const char *homeDir = getenv("HOME");
+            indexBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "walk") == 0) {
+            const char *homeDir = getenv("HOME");
+            indexWalkBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "scan") == 0) {
+            const char *homeDir = getenv("HOME");
+            indexScanBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "gzip") == 0) {
+            const char *homeDir = getenv("HOME");
+            archiveGzipBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "codec") == 0) {
+            const char *homeDir = getenv("HOME");
+            archiveCodecBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "pipeline") == 0) {
+            const char *homeDir = getenv("HOME");
+            archivePipelineBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "blocks") == 0) {
+            const char *homeDir = getenv("HOME");
+            archiveBlocksBenchmark(homeDir ? homeDir : ".");
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'b' && strcmp(optarg, "ext") == 0) {
+            indexExtensionBenchmark();
+            exit(EXIT_SUCCESS);
+        } else if (opt == 'w') {
+            numWorkers = atoi(optarg);
+        } else if (opt == 'c') {
+            mirrorConfig = optarg;
+        } else if (opt == 'C') {
+            cacheDir = optarg;
+        } else if (opt == 'M') {
+            cacheMb = atol(optarg);
+        } else if (opt == 'K') {
+            blockCacheMb = atol(optarg);
+        } else if (opt == 'a') {
+            maxActive = atoi(optarg);
+        } else if (opt == 'q') {
+            maxQueued = atoi(optarg);
+        } else if (opt == 'T') {
+            queueTimeoutMs = atoi(optarg);
+        } else if (opt == 'm') {
+            metricsPort = atoi(optarg);
+        } else if (opt == 'd' && strcmp(optarg, "least") == 0) {
+            dispatchPolicy = DISPATCH_LEAST;
+        } else if (opt == 'd' && strcmp(optarg, "p2c") == 0) {
+            dispatchPolicy = DISPATCH_P2C;
+        } else {
+            printUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((optind >= argc && node.port == 0) || numWorkers <= 0 || maxActive < 0 || maxQueued < 0 || queueTimeoutMs < 0 ||
+        metricsPort < 0) {
+        printUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int port = optind < argc ? atoi(argv[optind]) : node.port;
+    setvbuf(stdout, NULL, _IOLBF, 0); // Keep connection logs timely when redirected to a file
+
+    // Create server socket
+    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (serverSocket == -1) {
+        perror("Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    // Bind server socket
+    struct sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port = htons(port);
+
+    if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
+        perror("Socket bind failed");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    // Listen for incoming connections
+    if (listen(serverSocket, SOMAXCONN) == -1 || setNonBlocking(serverSocket) == -1) {
+        perror("Socket listen failed");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    // A mirror also takes clients serverw24 hands off over its control socket
+    if (node.role == SERVER_ROLE_MIRROR && openControlListener(port) == -1) {
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    // Create the reactor; workers wake it through an eventfd when a paused pipeline has room again
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd == -1 || initReactor(serverSocket) == -1) {
+        fprintf(stderr, "Failed to set up the %s reactor\n", REACTOR_NAME);
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    if (loadBackends(mirrorConfig, port) == -1) {
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    // Metrics are always recorded; other processes find them by the port
+    metrics = metricsCreate(node.name, port);
+    if (!metrics || (metricsPort > 0 && openMetricsPort(metricsPort) == -1)) {
+        fprintf(stderr, "Failed to set up metrics\n");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    // Index the tree under HOME once up front, one walker thread per CPU, and keep it current from change
+    // events; commands are answered from memory
+    const char *homeDir = getenv("HOME");
+    if (!homeDir || indexInit(&homeIndex, homeDir, 0) == -1 || indexWatch(&homeIndex) == -1) {
+        fprintf(stderr, "Failed to index the HOME directory\n");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+    homeIndex.scanned = &metrics->filesScanned;
+    printf("Indexed %d entries of %s\n", homeIndex.table.live, homeIndex.rootDir);
+
+    // The result cache is optional: without a usable directory, archives are just compressed every time
+    // Every node keeps its own cache, since each one accounts for the space it uses
+    char defaultCacheDir[64];
+    if (node.role == SERVER_ROLE_MIRROR) {
+        snprintf(defaultCacheDir, sizeof(defaultCacheDir), "/tmp/w24cache-%d-%s", (int)getuid(), node.name);
+    } else {
+        snprintf(defaultCacheDir, sizeof(defaultCacheDir), "/tmp/w24cache-%d", (int)getuid());
+    }
+    if (cacheMb > 0 && cacheInit(&resultCache, cacheDir ? cacheDir : defaultCacheDir,
+                                 (unsigned long long)cacheMb * 1024 * 1024) == 0) {
+        cacheEnabled = 1;
+        printf("Result cache in %s: %d entries, %llu of %ld MB\n", resultCache.dir, resultCache.count,
+               resultCache.total / (1024 * 1024), cacheMb);
+    }
+    if (blockCacheMb > 0 && blockCacheInit(&memberBlocks, (size_t)blockCacheMb * 1024 * 1024) == 0) {
+        blocksEnabled = 1;
+    }
+
+    // Without -a every connection is served at once
+    if (maxActive > 0) {
+        if (admissionInit(&admission, maxActive, maxQueued, queueTimeoutMs) == -1) {
+            fprintf(stderr, "Failed to set up admission control\n");
+            close(serverSocket);
+            exit(EXIT_FAILURE);
+        }
+        admissionEnabled = 1;
+        printf("Serving %d clients at once, up to %d more wait up to %d ms\n", maxActive, maxQueued, queueTimeoutMs);
+    }
+
+    // Start the worker threads which run the commands
+    threadPool pool;
+    if (threadPoolInit(&pool, numWorkers) == -1) {
+        fprintf(stderr, "Failed to start worker threads\n");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    if (node.role == SERVER_ROLE_MIRROR) {
+        printf("%s listening on port %d and " MIRROR_CTL_PATH_FMT " with %d worker threads (%s reactor)\n", node.name,
+               port, port, pool.numThreads, REACTOR_NAME);
+    } else {
+        printf("Server listening on port %d with %d worker threads and %d mirrors (%s dispatch, %s reactor)\n", port,
+               pool.numThreads, numBackends - 1,
+               dispatchPolicy == DISPATCH_LEAST ? "least-loaded" : "power-of-two-choices", REACTOR_NAME);
+    }
+
+    if (metricsPort > 0) {
+        printf("Metrics on http://localhost:%d/metrics\n", metricsPort);
+    }
+
+    runReactor(&pool, serverSocket);
+
+    threadPoolDestroy(&pool);
+    metricsRemove(port);
+    if (controlListener != -1) {
+        char ctlPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+        snprintf(ctlPath, sizeof(ctlPath), MIRROR_CTL_PATH_FMT, port);
+        close(controlListener);
+        unlink(ctlPath);
+    }
+    close(serverSocket); // Close server socket
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+//The server engine shared by serverw24, mirror1 and mirror2: the reactor, the worker pool, the request path
+//and the caches. A node's main only says which role it plays and on which port.
+#ifndef W24SERVER_H
+#define W24SERVER_H
+
+//Standard ports of the mirrors; serverw24 hands clients to them when it has no mirror config.
+#define MIRROR1_PORT 9090
+#define MIRROR2_PORT 9091
+
+//SERVER_ROLE_PRIMARY accepts clients and routes them across itself and its mirrors.
+//SERVER_ROLE_MIRROR serves the clients that connect to it or that serverw24 hands it, and reports its load
+//back to serverw24.
+#define SERVER_ROLE_PRIMARY 0
+#define SERVER_ROLE_MIRROR 1
+
+typedef struct serverConfig {
+    const char *name; // Node name in logs and w24stats
+    int role;         // SERVER_ROLE_*
+    int port;         // Default listening port; 0 makes the port argument mandatory
+} serverConfig;
+
+//Parse the command line (port, options, -b benchmarks), then serve clients until the reactor fails.
+//Returns the process exit status.
+int serverMain(const serverConfig *config, int argc, char *argv[]);
+
+#endif
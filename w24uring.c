@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "w24uring.h"
+
+static int ringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+int ringInit(w24Ring *ring, unsigned entries, unsigned completionEntries) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Completions are reaped by a thread that enters the kernel anyway, so skip interrupting it for them
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = completionEntries;
+
+    ring->fd = ringSetup(entries, &params);
+    if (ring->fd == -1 && errno == EINVAL) {
+        // Kernel before 5.19
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = completionEntries;
+        ring->fd = ringSetup(entries, &params);
+    }
+    if (ring->fd == -1) {
+        return -1;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sqMapLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqMapLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap && ring->cqMapLength > ring->sqMapLength) {
+        ring->sqMapLength = ring->cqMapLength;
+    }
+
+    ring->sqMap = mmap(NULL, ring->sqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+    if (ring->sqMap == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->cqMap = ring->sqMap;
+    if (!singleMap) {
+        ring->cqMap = mmap(NULL, ring->cqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_CQ_RING);
+        if (ring->cqMap == MAP_FAILED) {
+            munmap(ring->sqMap, ring->sqMapLength);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cqMap != ring->sqMap) {
+            munmap(ring->cqMap, ring->cqMapLength);
+        }
+        munmap(ring->sqMap, ring->sqMapLength);
+        close(ring->fd);
+        return -1;
+    }
+
+    char *sq = ring->sqMap;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqLocalTail = *ring->sqTail;
+
+    char *cq = ring->cqMap;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    pthread_mutex_init(&ring->lock, NULL);
+    return 0;
+}
+
+void ringFree(w24Ring *ring) {
+    munmap(ring->sqes, ring->sqesLength);
+    if (ring->cqMap != ring->sqMap) {
+        munmap(ring->cqMap, ring->cqMapLength);
+    }
+    munmap(ring->sqMap, ring->sqMapLength);
+    close(ring->fd);
+    pthread_mutex_destroy(&ring->lock);
+}
+
+struct io_uring_sqe *ringGetSqe(w24Ring *ring) {
+    while (ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->entries) {
+        // Full: what the caller filled so far is complete, so hand it all to the kernel to make room
+        ringPublish(ring);
+        if (ringSubmit(ring, 0) == -1) {
+            return NULL;
+        }
+    }
+
+    unsigned index = ring->sqLocalTail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+void ringPublish(w24Ring *ring) {
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+}
+
+int ringSubmit(w24Ring *ring, unsigned waitFor) {
+    while (1) {
+        // Asking for more than is published is harmless: the kernel submits what is there
+        unsigned toSubmit = __atomic_load_n(ring->sqTail, __ATOMIC_ACQUIRE) -
+                            __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (toSubmit == 0 && waitFor == 0) {
+            return 0;
+        }
+        int result = ringEnter(ring->fd, toSubmit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (result >= 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EBUSY || errno == EAGAIN) {
+            // Completions are backed up: there is something to reap, and the reaping thread submits the
+            // rest on its next call
+            return 0;
+        }
+        return -1;
+    }
+}
+
+struct io_uring_cqe *ringPeek(w24Ring *ring) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cqMask];
+}
+
+void ringAdvance(w24Ring *ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+void ringPrepAccept(struct io_uring_sqe *sqe, int fd, int multishot, uint64_t userData) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = userData;
+}
+
+void ringPrepPoll(struct io_uring_sqe *sqe, int fd, unsigned events, uint64_t userData) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = userData;
+}
+
+void ringPrepRecv(struct io_uring_sqe *sqe, int fd, void *buffer, size_t length, uint64_t userData) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length;
+    sqe->user_data = userData;
+}
+
+void ringPrepSend(struct io_uring_sqe *sqe, int fd, const void *data, size_t length, int flags, uint64_t userData) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = length;
+    sqe->msg_flags = flags;
+    sqe->user_data = userData;
+}
+
+void ringPrepCancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t userData) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+}
+
+void ringPrepTimeout(struct io_uring_sqe *sqe, struct __kernel_timespec *timeout, uint64_t userData) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)timeout;
+    sqe->len = 1;
+    sqe->off = 0; // No completion count, just the time
+    sqe->user_data = userData;
+}
@@ -0,0 +1,66 @@
+//Minimal io_uring ring on the raw system calls (no liburing): one submission and one completion queue shared
+//by the reactor and the worker threads. Only serverw24 built with -DW24_USE_IO_URING uses it.
+#ifndef W24URING_H
+#define W24URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+typedef struct w24Ring {
+    int fd;
+    unsigned entries;
+
+    // Submission queue: the kernel consumes from head, we publish at tail
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned sqLocalTail; // Entries handed out so far, published under lock
+
+    // Completion queue: the kernel posts at tail, one thread reaps from head
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqMap;
+    size_t sqMapLength;
+    void *cqMap; // Same as sqMap when the kernel maps both rings together
+    size_t cqMapLength;
+    size_t sqesLength;
+
+    pthread_mutex_t lock; // Held by any thread filling submission entries
+} w24Ring;
+
+//Set up a ring with entries submission slots and completionEntries completion slots. Returns -1 with errno
+//set if the kernel has no io_uring (or it is disabled).
+int ringInit(w24Ring *ring, unsigned entries, unsigned completionEntries);
+void ringFree(w24Ring *ring);
+
+//Zeroed submission entry for the caller to fill. The caller holds ring->lock until ringPublish; when the
+//queue is full the entries already in it are submitted first. Returns NULL only if that fails.
+struct io_uring_sqe *ringGetSqe(w24Ring *ring);
+//Make the filled entries visible to the kernel. The caller still holds ring->lock.
+void ringPublish(w24Ring *ring);
+
+//Submit every published entry and wait for at least waitFor completions. Any thread may call it, with or
+//without ring->lock: whichever call comes first submits them all. Returns -1 on error (EINTR is retried).
+int ringSubmit(w24Ring *ring, unsigned waitFor);
+
+//Completions are reaped by one thread: the next unseen one or NULL, then ringAdvance once it is handled.
+struct io_uring_cqe *ringPeek(w24Ring *ring);
+void ringAdvance(w24Ring *ring);
+
+//Fill an entry for one operation; userData comes back in its completions.
+void ringPrepAccept(struct io_uring_sqe *sqe, int fd, int multishot, uint64_t userData);
+void ringPrepPoll(struct io_uring_sqe *sqe, int fd, unsigned events, uint64_t userData);
+void ringPrepRecv(struct io_uring_sqe *sqe, int fd, void *buffer, size_t length, uint64_t userData);
+void ringPrepSend(struct io_uring_sqe *sqe, int fd, const void *data, size_t length, int flags, uint64_t userData);
+void ringPrepCancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t userData);
+//A timer: completes with -ETIME once the relative time in *timeout has passed. *timeout must stay valid until then.
+void ringPrepTimeout(struct io_uring_sqe *sqe, struct __kernel_timespec *timeout, uint64_t userData);
+
+#endif
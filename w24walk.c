@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "w24walk.h"
+
+#define INITIAL_DEQUE 64
+#define INITIAL_RESULT_ENTRIES 1024
+
+//Directory entries are read this many bytes at a time: a few hundred names per getdents64 call.
+#define DIRENT_BUFFER_LEN (64 * 1024)
+
+//The only attributes the index keeps; statx leaves the rest (uid, gid, blocks, atime...) unfetched. ctime
+//stands in for the birth time on filesystems that do not record one.
+#define STATX_FIELDS (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_BTIME | STATX_CTIME | STATX_MTIME)
+
+//How long an idle walker sleeps before looking for work to steal again.
+#define IDLE_SLEEP_NS 50000
+
+//Directories waiting to be read, as paths relative to the root. The owner pushes and pops at the tail
+//(depth first, so its working set stays small); thieves take from the head, which holds the shallowest
+//directories and therefore the biggest pieces of remaining work.
+typedef struct walkDeque {
+    char **paths;
+    int head;
+    int tail;
+    int capacity;
+    pthread_mutex_t lock;
+} walkDeque;
+
+typedef struct walkShared {
+    int rootFd;
+    int numThreads;
+    walkDeque *deques;
+    walkResult *results;
+    atomic_int pending; // Directories pushed but not finished; the walk is over when it drops to 0
+} walkShared;
+
+typedef struct walkThreadArg {
+    walkShared *shared;
+    int self;
+} walkThreadArg;
+
+//The record getdents64 fills in; glibc only declares struct dirent, whose layout may differ.
+typedef struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linuxDirent64;
+
+//walkStatEntry, adding the system calls it made to *syscalls. With d_type known, every entry takes one
+//statx; only DT_UNKNOWN (some filesystems) needs a no-follow probe first, and that probe is the answer
+//unless the entry is a symlink.
+static int statEntry(int dirFd, const char *name, unsigned char dType, walkEntry *entry, unsigned long *syscalls) {
+    struct statx stx;
+    int probed = 0;
+    if (dType == DT_UNKNOWN) {
+        (*syscalls)++;
+        if (statx(dirFd, name, AT_SYMLINK_NOFOLLOW, STATX_FIELDS, &stx) != 0) {
+            return -1;
+        }
+        if (S_ISLNK(stx.stx_mode)) {
+            dType = DT_LNK;
+        } else {
+            dType = S_ISREG(stx.stx_mode) ? DT_REG : S_ISDIR(stx.stx_mode) ? DT_DIR : DT_UNKNOWN;
+            probed = 1;
+        }
+    }
+    if (!probed) {
+        (*syscalls)++;
+        if (statx(dirFd, name, 0, STATX_FIELDS, &stx) != 0) {
+            return -1;
+        }
+    }
+
+    entry->size = stx.stx_size;
+    entry->btime = (stx.stx_mask & STATX_BTIME) ? stx.stx_btime.tv_sec : stx.stx_ctime.tv_sec;
+    entry->mtime = stx.stx_mtime.tv_sec;
+    entry->mode = stx.stx_mode;
+    entry->type = dType == DT_REG ? INDEX_TYPE_FILE : dType == DT_DIR ? INDEX_TYPE_DIR : INDEX_TYPE_OTHER;
+    return 0;
+}
+
+int walkStatEntry(int dirFd, const char *name, unsigned char dType, walkEntry *entry) {
+    unsigned long syscalls = 0;
+    return statEntry(dirFd, name, dType, entry, &syscalls);
+}
+
+static int pushPath(walkDeque *deque, char *path) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity) {
+        // Slide live paths to the front before growing
+        int live = deque->tail - deque->head;
+        if (deque->head > 0 && live < deque->capacity / 2) {
+            memmove(deque->paths, deque->paths + deque->head, sizeof(char *) * live);
+        } else {
+            int capacity = deque->capacity ? deque->capacity * 2 : INITIAL_DEQUE;
+            char **paths = malloc(sizeof(char *) * capacity);
+            if (!paths) {
+                pthread_mutex_unlock(&deque->lock);
+                return -1;
+            }
+            memcpy(paths, deque->paths + deque->head, sizeof(char *) * live);
+            free(deque->paths);
+            deque->paths = paths;
+            deque->capacity = capacity;
+        }
+        deque->head = 0;
+        deque->tail = live;
+    }
+    deque->paths[deque->tail++] = path;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+static char *popPath(walkDeque *deque, int fromHead) {
+    char *path = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        path = fromHead ? deque->paths[deque->head++] : deque->paths[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return path;
+}
+
+//Append one entry and its path to a thread's result.
+static int recordEntry(walkResult *result, const char *path, size_t pathLength, const walkEntry *entry) {
+    if (result->count == result->capacity) {
+        int capacity = result->capacity ? result->capacity * 2 : INITIAL_RESULT_ENTRIES;
+        walkEntry *entries = realloc(result->entries, sizeof(walkEntry) * capacity);
+        if (!entries) {
+            return -1;
+        }
+        result->entries = entries;
+        result->capacity = capacity;
+    }
+    if (result->pathsLen + pathLength + 1 > result->pathsCap) {
+        size_t capacity = result->pathsCap ? result->pathsCap * 2 : INITIAL_RESULT_ENTRIES * 32;
+        while (capacity < result->pathsLen + pathLength + 1) {
+            capacity *= 2;
+        }
+        char *paths = realloc(result->paths, capacity);
+        if (!paths) {
+            return -1;
+        }
+        result->paths = paths;
+        result->pathsCap = capacity;
+    }
+
+    walkEntry *stored = &result->entries[result->count++];
+    *stored = *entry;
+    stored->pathOffset = result->pathsLen;
+    memcpy(result->paths + result->pathsLen, path, pathLength + 1);
+    result->pathsLen += pathLength + 1;
+    return 0;
+}
+
+//Read one directory in getdents64 batches, recording its entries and queueing its subdirectories on this
+//thread's deque. Every stat is relative to the directory fd, so the kernel never walks the path again.
+static void readDirectory(walkShared *shared, int self, const char *dirPath, char *buffer) {
+    walkResult *result = &shared->results[self];
+    result->syscalls += 2; // openat and close
+    int fd = openat(shared->rootFd, dirPath[0] ? dirPath : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return; // Removed or unreadable since it was found
+    }
+
+    char path[PATH_MAX];
+    size_t prefix = 0;
+    if (dirPath[0]) {
+        prefix = snprintf(path, sizeof(path), "%s/", dirPath);
+    }
+
+    ssize_t length;
+    while (result->syscalls++, (length = getdents64(fd, buffer, DIRENT_BUFFER_LEN)) > 0) {
+        for (ssize_t pos = 0; pos < length;) {
+            const linuxDirent64 *dirEntry = (const linuxDirent64 *)(buffer + pos);
+            pos += dirEntry->d_reclen;
+
+            const char *name = dirEntry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            size_t nameLength = strlen(name);
+            if (prefix + nameLength >= sizeof(path)) {
+                continue;
+            }
+            memcpy(path + prefix, name, nameLength + 1);
+
+            walkEntry entry;
+            if (statEntry(fd, name, dirEntry->d_type, &entry, &result->syscalls) != 0) {
+                continue;
+            }
+            if (recordEntry(result, path, prefix + nameLength, &entry) == -1) {
+                fprintf(stderr, "Out of memory walking %s\n", path);
+                close(fd);
+                return;
+            }
+
+            if (entry.type == INDEX_TYPE_DIR) {
+                char *subPath = strdup(path);
+                atomic_fetch_add(&shared->pending, 1);
+                if (!subPath || pushPath(&shared->deques[self], subPath) == -1) {
+                    free(subPath);
+                    atomic_fetch_sub(&shared->pending, 1);
+                }
+            }
+        }
+    }
+    close(fd);
+}
+
+static void *walkWorker(void *arg) {
+    walkThreadArg *threadArg = arg;
+    walkShared *shared = threadArg->shared;
+    int self = threadArg->self;
+    char *buffer = malloc(DIRENT_BUFFER_LEN);
+    if (!buffer) {
+        return NULL; // The other threads steal what would have been this one's work
+    }
+
+    while (1) {
+        char *path = popPath(&shared->deques[self], 0);
+        for (int i = 1; path == NULL && i < shared->numThreads; i++) {
+            path = popPath(&shared->deques[(self + i) % shared->numThreads], 1);
+        }
+
+        if (path == NULL) {
+            if (atomic_load(&shared->pending) == 0) {
+                break;
+            }
+            // Others are still reading directories that may yield more work
+            struct timespec idle = { 0, IDLE_SLEEP_NS };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        readDirectory(shared, self, path, buffer);
+        free(path);
+        atomic_fetch_sub(&shared->pending, 1);
+    }
+    free(buffer);
+    return NULL;
+}
+
+int walkTree(const char *rootDir, const char *startPath, int numThreads, walkResult **results) {
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+
+    walkShared shared;
+    shared.rootFd = open(rootDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (shared.rootFd == -1) {
+        fprintf(stderr, "Failed to open %s for indexing: %s\n", rootDir, strerror(errno));
+        return -1;
+    }
+    if (startPath[0]) {
+        struct stat st;
+        if (fstatat(shared.rootFd, startPath, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode)) {
+            close(shared.rootFd);
+            return -1;
+        }
+    }
+
+    shared.numThreads = numThreads;
+    shared.deques = calloc(numThreads, sizeof(walkDeque));
+    shared.results = calloc(numThreads, sizeof(walkResult));
+    walkThreadArg *args = calloc(numThreads, sizeof(walkThreadArg));
+    pthread_t *threads = calloc(numThreads, sizeof(pthread_t));
+    char *start = strdup(startPath);
+    if (!shared.deques || !shared.results || !args || !threads || !start) {
+        free(shared.deques);
+        free(shared.results);
+        free(args);
+        free(threads);
+        free(start);
+        close(shared.rootFd);
+        return -1;
+    }
+    for (int i = 0; i < numThreads; i++) {
+        pthread_mutex_init(&shared.deques[i].lock, NULL);
+    }
+
+    atomic_init(&shared.pending, 1);
+    pushPath(&shared.deques[0], start);
+
+    // The calling thread walks as worker 0; threads that fail to start just leave more to steal
+    int started = 1;
+    for (int i = 0; i < numThreads; i++) {
+        args[i].shared = &shared;
+        args[i].self = i;
+    }
+    while (started < numThreads && pthread_create(&threads[started], NULL, walkWorker, &args[started]) == 0) {
+        started++;
+    }
+    walkWorker(&args[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        free(shared.deques[i].paths);
+        pthread_mutex_destroy(&shared.deques[i].lock);
+    }
+    free(shared.deques);
+    free(args);
+    free(threads);
+    close(shared.rootFd);
+
+    *results = shared.results;
+    return numThreads;
+}
+
+void walkResultsFree(walkResult *results, int numResults) {
+    for (int i = 0; i < numResults; i++) {
+        free(results[i].entries);
+        free(results[i].paths);
+    }
+    free(results);
+}
@@ -0,0 +1,48 @@
+//Parallel directory tree walker used to build the metadata index.
+#ifndef W24WALK_H
+#define W24WALK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Entry types; the index marks removed entries INDEX_TYPE_FREE.
+#define INDEX_TYPE_FREE 0
+#define INDEX_TYPE_FILE 1
+#define INDEX_TYPE_DIR 2
+#define INDEX_TYPE_OTHER 3
+
+//Attributes of one entry, as the index stores them.
+typedef struct walkEntry {
+    uint32_t pathOffset; // Into the owning walkResult's paths
+    uint32_t mode;
+    int64_t size;
+    int64_t btime;       // Birth time (statx STX_BTIME), or ctime where the filesystem has none
+    int64_t mtime;
+    uint8_t type;        // INDEX_TYPE_*
+} walkEntry;
+
+//What one walker thread found: entries plus their paths relative to the root, back to back.
+typedef struct walkResult {
+    walkEntry *entries;
+    int count;
+    int capacity;
+    char *paths;
+    size_t pathsLen;
+    size_t pathsCap;
+    unsigned long syscalls; // openat, getdents64, statx and close calls made, for the benchmark
+} walkResult;
+
+//Stat one entry of dirFd the way the index does: sizes and times follow symlinks, but only real files and
+//directories get those types (a symlink is never listed, archived or descended into). dType may be
+//DT_UNKNOWN. Returns -1 if the entry is gone or cannot be stat'ed.
+int walkStatEntry(int dirFd, const char *name, unsigned char dType, walkEntry *entry);
+
+//Walk rootDir/startPath ("" for rootDir itself) with numThreads threads. Each thread takes directories
+//from its own deque and steals from the others when it runs dry, reads them in large getdents64 batches
+//and statx'es their entries relative to the directory fd. The entries below startPath (not
+//startPath itself) are returned in *results, one walkResult per thread. Returns -1 if startPath cannot
+//be opened.
+int walkTree(const char *rootDir, const char *startPath, int numThreads, walkResult **results);
+void walkResultsFree(walkResult *results, int numResults);
+
+#endif